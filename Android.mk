@@ -39,6 +39,8 @@ LOCAL_SRC_FILES := \
 	backlight.c \
 	power.c \
 	log.c \
+	loop.c \
+	telemetry.c \
 	ui.c 
 
 
@@ -46,6 +48,12 @@ ifeq ($(strip $(HAVE_KEYBOARD_BACKLIGHT)),true)
 LOCAL_CFLAGS += -DK_BACKLIGHT
 endif
 
+# Batch power_supply sysfs reads through io_uring (falls back to pread()
+# at runtime when the kernel lacks it or vendor.charge.io_uring=0).
+ifeq ($(strip $(CHARGE_USE_IO_URING)),true)
+LOCAL_CFLAGS += -DBATTERY_IO_URING
+endif
+
 LOCAL_MODULE := charge 
 LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE_PATH := $(TARGET_SYSTEM_OUT_BIN)
@@ -61,6 +69,65 @@ LOCAL_PROPRIETARY_MODULE := true
 include $(BUILD_EXECUTABLE)
 
 
+# Offline decoder for /mnt/vendor/charge_telemetry, run on the host.
+include $(CLEAR_VARS)
+LOCAL_MODULE := charge_telemetry_dump
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := telemetry_dump.c
+include $(BUILD_HOST_EXECUTABLE)
+
+# Sysfs syscalls and latency of a battery refresh, with pread() and
+# io_uring, against a fake power_supply tree; see battery_bench.c.
+include $(CLEAR_VARS)
+LOCAL_MODULE := charge_battery_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := battery_bench.c
+LOCAL_CFLAGS += -DBATTERY_IO_URING
+LOCAL_STATIC_LIBRARIES := libcutils
+include $(BUILD_HOST_EXECUTABLE)
+
+# Power key to photon latency of the real ui/power/minui code, on a
+# Linux host with /dev/uinput (run as root); see wake_bench.c.
+include $(CLEAR_VARS)
+LOCAL_MODULE := charge_wake_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+	wake_bench.c \
+	ui.c \
+	power.c \
+	loop.c \
+	minui/events.c \
+	minui/graphics.c \
+	minui/raster.c \
+	minui/resources.c
+LOCAL_C_INCLUDES += external/libpng external/zlib
+LOCAL_CFLAGS += -DMINUI_NO_VT -DOVERSCAN_PERCENT=0
+LOCAL_CFLAGS += -DRES_IMAGE_DIR=\"$(abspath $(LOCAL_PATH))/images\"
+LOCAL_STATIC_LIBRARIES := libpng libz libcutils
+include $(BUILD_HOST_EXECUTABLE)
+
+# Charging screen frame times at every supported resolution on the
+# headless minui backend, and a pixel check against
+# frame_bench.golden; see frame_bench.c.
+include $(CLEAR_VARS)
+LOCAL_MODULE := charge_frame_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+	frame_bench.c \
+	power.c \
+	loop.c \
+	minui/events.c \
+	minui/graphics.c \
+	minui/graphics_mem.c \
+	minui/raster.c \
+	minui/resources.c
+LOCAL_C_INCLUDES += external/libpng external/zlib
+LOCAL_CFLAGS += -DMINUI_NO_VT -DMINUI_MEM_BACKEND -DOVERSCAN_PERCENT=0
+LOCAL_CFLAGS += -DRES_IMAGE_DIR=\"$(abspath $(LOCAL_PATH))/images\"
+LOCAL_CFLAGS += -DFRAME_GOLDEN=\"$(abspath $(LOCAL_PATH))/frame_bench.golden\"
+LOCAL_STATIC_LIBRARIES := libpng libz libcutils
+include $(BUILD_HOST_EXECUTABLE)
+
 include $(commands_recovery_local_path)/minui/Android.mk
 include $(commands_recovery_local_path)/suspend/Android.mk
 
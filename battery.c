@@ -27,17 +27,71 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <linux/netlink.h>
 #include "common.h"
 
+#ifdef BATTERY_IO_URING
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "cutils/properties.h"
+#endif
 
 #if HAVE_ANDROID_OS
 #include <linux/ioctl.h>
 #endif
 
 #include "battery.h"
+#include "telemetry.h"
+#include "loop.h"
 
 
+#ifndef POWER_SUPPLY_PATH
 #define POWER_SUPPLY_PATH "/sys/class/power_supply"
+#endif
+#define POWER_SUPPLY_SUBSYSTEM "SUBSYSTEM=power_supply"
+
+#define UEVENT_MSG_LEN 2048
+#define UEVENT_RCVBUF_SIZE (64 * 1024)
+/* Between uevents every field is also re-read on its own schedule,
+ * which covers drivers that never emit power_supply uevents.  A field
+ * whose value is moving (by at least trend_delta) has its interval
+ * halved down to min_ms; a stable field backs off by doubling up to
+ * max_ms.  Fields that come due within a quarter of their interval of
+ * the same wakeup are read together, so the thread wakes once for all
+ * of them.
+ */
+struct FieldSchedule {
+    int min_ms;
+    int max_ms;
+    int trend_delta;
+    int interval_ms;
+    long long due_ms;
+    int last_value;
+};
+
+static struct FieldSchedule gSchedule[mBatteryEnd] = {
+    [mAcOnline]             = {   500,  5000,  1 },
+    [mUsbOnline]            = {   500,  5000,  1 },
+    [mBatteryStatus]        = {  1000, 10000,  1 },
+    [mBatteryHealth]        = { 10000, 60000,  1 },
+    [mBatteryPresent]       = { 10000, 60000,  1 },
+    [mBatteryLevel]         = {  2000, 30000,  1 },
+    [mBatteryVoltage]       = {  2000, 30000, 20 },     /* mV */
+    [mBatteryTemperature]   = {  5000, 60000, 10 },     /* 0.1 degC */
+    /* mBatteryTechnology is never re-read */
+};
+
+/* Above this temperature (0.1 degC) a rising reading is polled at the
+ * fastest rate, since it is heading for an overheat shutdown.
+ */
+#define BATTERY_TEMP_WARN 450
+
+#define FIELD_ALL ((1u << mBatteryEnd) - 1)
 
 enum gFieldID gFieldIds;
 
@@ -57,25 +111,104 @@ struct BatteryManagerConstants {
 };
 static struct BatteryManagerConstants gConstants;
 
-struct PowerSupplyPaths {
-    char* acOnlinePath;
-    char* usbOnlinePath;
-    char* batteryStatusPath;
-    char* batteryHealthPath;
-    char* batteryPresentPath;
-    char* batteryCapacityPath;
-    char* batteryVoltagePath;
-    char* batteryTemperaturePath;
-    char* batteryTechnologyPath;
+/* One sysfs attribute.  The descriptor is opened the first time the
+ * attribute is read and then kept open; sysfs regenerates the value on
+ * every pread() at offset 0.
+ */
+struct PowerSupplyPath {
+    char* path;
+    int fd;
+};
+
+static const char* gPathNames[mBatteryEnd] = {
+    [mAcOnline] = "acOnlinePath",
+    [mUsbOnline] = "usbOnlinePath",
+    [mBatteryStatus] = "batteryStatusPath",
+    [mBatteryHealth] = "batteryHealthPath",
+    [mBatteryPresent] = "batteryPresentPath",
+    [mBatteryLevel] = "batteryCapacityPath",
+    [mBatteryVoltage] = "batteryVoltagePath",
+    [mBatteryTemperature] = "batteryTemperaturePath",
+    [mBatteryTechnology] = "batteryTechnologyPath",
+};
+
+/* Every power_supply directory is registered with its type.  A charger
+ * carries one online field: mUsbOnline for "USB", mAcOnline for Mains,
+ * Wireless and the dedicated USB_* charger types.  A battery carries
+ * the remaining fields, plus charge_full which weights its capacity.
+ * PowerSupplyStatus[] is the aggregate over all registered supplies.
+ *
+ * The same values are also exported as POWER_SUPPLY_<ATTR>=<value>
+ * lines in each supply's "uevent" file, so one pread() per supply can
+ * replace the per-attribute reads.  keys[] holds the <ATTR> part for
+ * every field that was found in the uevent file; fields with an empty
+ * key keep using their own attribute file.
+ */
+enum PowerSupplyType {
+    SUPPLY_AC = 0,
+    SUPPLY_USB,
+    SUPPLY_BATTERY,
+    SUPPLY_END,
+};
+
+#define UEVENT_FILE_LEN 4096
+#define UEVENT_KEY_PREFIX "POWER_SUPPLY_"
+#define UEVENT_KEY_MAX 32
+
+#define MAX_POWER_SUPPLIES 16
+#define POWER_SUPPLY_NAME_MAX 64
+#define SUPPLIES_ALL (~0u)
+
+struct PowerSupply {
+    char name[POWER_SUPPLY_NAME_MAX];
+    enum PowerSupplyType type;
+    int removed;
+    unsigned int fields;        /* FIELD_BIT() of every field it carries */
+    struct PowerSupplyPath uevent;
+    struct PowerSupplyPath paths[mBatteryEnd];
+    char keys[mBatteryEnd][UEVENT_KEY_MAX];
+    int voltageDivisor;
+    int chargeFull;
+    int chargeCounter;          /* uAh */
+    int currentNow;             /* uA, positive while charging */
+    unsigned int extras;        /* EXTRA_* found in the uevent file */
+    int value[mBatteryEnd];
 };
 
-static struct PowerSupplyPaths gPaths;
+/* Attributes that are not PowerSupplyStatus[] fields but feed the
+ * time-to-full estimate.  They are only ever taken from the uevent
+ * file that is read anyway, never read on their own.
+ */
+#define EXTRA_CHARGE_FULL       (1u << 0)
+#define EXTRA_CHARGE_COUNTER    (1u << 1)
+#define EXTRA_CURRENT_NOW       (1u << 2)
+#define EXTRA_COULOMB (EXTRA_CHARGE_FULL | EXTRA_CHARGE_COUNTER | EXTRA_CURRENT_NOW)
+
+static struct PowerSupply gSupplies[MAX_POWER_SUPPLIES];
+static int gNrSupplies;
+
+/* Number of sysfs syscalls issued by the last refresh; battery_bench.c
+ * reports it.
+ */
+static int gRefreshSyscalls;
 
 int PowerSupplyStatus[mBatteryEnd];
 
+// Serializes writers of PowerSupplyStatus[] and the supply registry;
+// readers never take it.
 pthread_mutex_t gBatteryMutex = PTHREAD_MUTEX_INITIALIZER;
 
-static int gVoltageDivisor = 1;
+/* Published copy of PowerSupplyStatus[], guarded by a seqlock: the
+ * sequence is odd while battery_publish_locked() is rewriting gState,
+ * so readers retry until they see the same even value on both sides
+ * of their copy.
+ */
+static atomic_uint gStateSeq;
+static struct battery_state gState;
+
+#define FIELD_BIT(id) (1u << (id))
+
+static int gUeventFd = -1;
 
 static int getBatteryStatus(const char* status) {
     switch (status[0]) {
@@ -143,173 +276,1067 @@ static int readFromFile(const char* path, char* buf, size_t size) {
     return count;
 }
 
-static void setBooleanField(const char* path, enum gFieldID fieldID) {
-    const int SIZE = 16;
-    char buf[SIZE];
+static void closePath(struct PowerSupplyPath* p) {
+    if (p->fd >= 0) {
+        close(p->fd);
+        gRefreshSyscalls++;
+    }
+    p->fd = -1;
+}
+
+static int openPath(struct PowerSupplyPath* p) {
+    p->fd = open(p->path, O_RDONLY | O_CLOEXEC, 0);
+    gRefreshSyscalls++;
+    if (p->fd == -1) {
+        LOGE("Could not open '%s'", p->path);
+        return -1;
+    }
+    return 0;
+}
+
+// Terminate what a read returned, dropping trailing newlines.
+static int terminateRead(char* buf, ssize_t count, size_t size) {
+    if (count > 0) {
+        count = ((size_t)count < size) ? count : (ssize_t)size - 1;
+        while (count > 0 && buf[count-1] == '\n') count--;
+        buf[count] = '\0';
+    } else {
+        buf[0] = '\0';
+    }
+    return count;
+}
+
+static int readFromPath(struct PowerSupplyPath* p, char* buf, size_t size) {
+    ssize_t count = -1;
+    int retry;
+
+    if (!p->path)
+        return -1;
 
-    char value = 0;
-    if (readFromFile(path, buf, SIZE) > 0) {
-        if (buf[0] == '1') {
-            value = 1;
+    for (retry = 0; retry < 2; retry++) {
+        if (p->fd < 0 && openPath(p) < 0)
+            return -1;
+
+        count = pread(p->fd, buf, size, 0);
+        gRefreshSyscalls++;
+        if (count >= 0)
+            break;
+
+        // The supply was unregistered and registered again; the old
+        // descriptor now points at a dead kernfs node.
+        if (errno != ENODEV && errno != ESTALE) {
+            LOGE("Could not read '%s': %s", p->path, strerror(errno));
+            return -1;
         }
+        closePath(p);
     }
-    PowerSupplyStatus[fieldID] = value;
+    if (count < 0)
+        return -1;
+
+    return terminateRead(buf, count, size);
 }
 
-static void setIntField(const char* path, enum gFieldID fieldID) {
-    const int SIZE = 128;
-    char buf[SIZE];
+/* One read of a refresh.  count is what readFromPath() would return. */
+struct BatteryRead {
+    struct PowerSupplyPath* path;
+    char* buf;
+    size_t size;
+    int count;
+};
+
+#ifdef BATTERY_IO_URING
+/* All reads of a refresh are queued on an io_uring and reaped with a
+ * single io_uring_enter(), instead of one pread() each.  The ring is
+ * set up once in battery_status_init(); if the kernel has no io_uring,
+ * or vendor.charge.io_uring is 0, gRing.fd stays -1 and readBatch()
+ * uses pread().
+ */
+#define BATTERY_RING_ENTRIES 16
+
+struct BatteryRing {
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+};
 
-    int value = 0;
-    if (readFromFile(path, buf, SIZE) > 0) {
-        value = atoi(buf);
+static struct BatteryRing gRing = { .fd = -1 };
+
+static int battery_ring_init(void) {
+    char prop[PROPERTY_VALUE_MAX];
+    struct io_uring_params params;
+    size_t sq_size, cq_size;
+    unsigned char *sq, *cq = MAP_FAILED;
+    void* sqes;
+    int fd;
+
+    property_get("vendor.charge.io_uring", prop, "1");
+    if (prop[0] == '0')
+        return -1;
+
+    memset(&params, 0, sizeof(params));
+    fd = syscall(__NR_io_uring_setup, BATTERY_RING_ENTRIES, &params);
+    if (fd < 0) {
+        LOGE("io_uring_setup failed: %s, using pread\n", strerror(errno));
+        return -1;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && cq_size > sq_size)
+        sq_size = cq_size;
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        goto fail;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            goto fail_sq;
     }
-    PowerSupplyStatus[fieldID] = value;
+
+    sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        goto fail_cq;
+
+    gRing.sq_ring = sq;
+    gRing.sq_ring_size = sq_size;
+    gRing.cq_ring = cq;
+    gRing.cq_ring_size = cq_size;
+    gRing.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    gRing.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    gRing.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    gRing.sq_array = (unsigned*)(sq + params.sq_off.array);
+    gRing.cq_head = (unsigned*)(cq + params.cq_off.head);
+    gRing.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    gRing.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    gRing.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    gRing.sqes = sqes;
+    gRing.fd = fd;
+    return 0;
+
+fail_cq:
+    if (cq != sq)
+        munmap(cq, cq_size);
+fail_sq:
+    munmap(sq, sq_size);
+fail:
+    LOGE("io_uring mmap failed: %s, using pread\n", strerror(errno));
+    close(fd);
+    return -1;
 }
 
-static void setInt(enum gFieldID fieldID, int value) {
-    PowerSupplyStatus[fieldID] = value;
+// Stop using the ring after a failed submit or wait.  The 'inflight'
+// reads that were submitted but not reaped are waited for first, so
+// none of them completes into a buffer that is reused by the pread()
+// fallback; if even that wait fails, closing the ring cancels them.
+static void battery_ring_drop(int inflight) {
+    unsigned head = *gRing.cq_head;
+
+    while (inflight > 0) {
+        unsigned cq_tail = __atomic_load_n(gRing.cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != cq_tail; head++)
+            inflight--;
+        __atomic_store_n(gRing.cq_head, head, __ATOMIC_RELEASE);
+        if (inflight > 0 && syscall(__NR_io_uring_enter, gRing.fd, 0, inflight,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            break;
+    }
+
+    munmap(gRing.sqes, gRing.sqes_size);
+    if (gRing.cq_ring != gRing.sq_ring)
+        munmap(gRing.cq_ring, gRing.cq_ring_size);
+    munmap(gRing.sq_ring, gRing.sq_ring_size);
+    close(gRing.fd);
+    gRing.fd = -1;
 }
-static void setVoltageField(const char* path, enum gFieldID fieldID) {
-    const int SIZE = 128;
-    char buf[SIZE];
 
-    int value = 0;
-    if (readFromFile(path, buf, SIZE) > 0) {
-        value = atoi(buf);
-        value /= gVoltageDivisor;
+// Returns -1 if the batch cannot be submitted or reaped; the caller
+// then reads the whole batch again with pread().
+static int battery_ring_read(struct BatteryRead* reads, int n) {
+    // Static: a read the ring is dropped with may still land in it.
+    static struct iovec iov[BATTERY_RING_ENTRIES];
+    unsigned tail, head;
+    int i, ret, queued = 0, submitted = 0, reaped = 0;
+
+    if (gRing.fd < 0 || n > BATTERY_RING_ENTRIES)
+        return -1;
+
+    tail = *gRing.sq_tail;
+    for (i = 0; i < n; i++) {
+        struct PowerSupplyPath* p = reads[i].path;
+        struct io_uring_sqe* sqe;
+        unsigned idx;
+
+        reads[i].count = -1;
+        if (!p->path || (p->fd < 0 && openPath(p) < 0))
+            continue;
+
+        idx = tail & *gRing.sq_mask;
+        sqe = &gRing.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        iov[i].iov_base = reads[i].buf;
+        iov[i].iov_len = reads[i].size;
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = p->fd;
+        sqe->addr = (uintptr_t)&iov[i];
+        sqe->len = 1;
+        sqe->off = 0;
+        sqe->user_data = i;
+        gRing.sq_array[idx] = idx;
+        tail++;
+        queued++;
     }
-    PowerSupplyStatus[fieldID] = value;
+    if (!queued)
+        return 0;
+
+    __atomic_store_n(gRing.sq_tail, tail, __ATOMIC_RELEASE);
+    // One call normally submits the batch and waits for all of it.  The
+    // kernel may take fewer entries, or a signal may come first; then
+    // submit the rest.
+    while (submitted < queued) {
+        ret = syscall(__NR_io_uring_enter, gRing.fd, queued - submitted, queued,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        gRefreshSyscalls++;
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            LOGE("io_uring_enter failed: %s, using pread\n",
+                    ret < 0 ? strerror(errno) : "nothing submitted");
+            battery_ring_drop(submitted);
+            return -1;
+        }
+        submitted += ret;
+    }
+
+    head = *gRing.cq_head;
+    while (reaped < queued) {
+        unsigned cq_tail = __atomic_load_n(gRing.cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != cq_tail; head++, reaped++) {
+            struct io_uring_cqe* cqe = &gRing.cqes[head & *gRing.cq_mask];
+            struct BatteryRead* r = &reads[cqe->user_data];
+
+            if (cqe->res >= 0) {
+                r->count = terminateRead(r->buf, cqe->res, r->size);
+            } else if (cqe->res == -ENODEV || cqe->res == -ESTALE) {
+                closePath(r->path);
+                r->count = readFromPath(r->path, r->buf, r->size);
+            }
+        }
+        __atomic_store_n(gRing.cq_head, head, __ATOMIC_RELEASE);
+
+        if (reaped < queued) {
+            ret = syscall(__NR_io_uring_enter, gRing.fd, 0, queued - reaped,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+            gRefreshSyscalls++;
+            if (ret < 0 && errno != EINTR) {
+                LOGE("io_uring wait failed: %s, using pread\n", strerror(errno));
+                battery_ring_drop(queued - reaped);
+                return -1;
+            }
+        }
+    }
+    return 0;
 }
+#endif
 
-extern int is_exit;
+// Issue every read of a refresh, batched on the io_uring when there is
+// one, otherwise one pread() each.
+static void readBatch(struct BatteryRead* reads, int n) {
+    int i = 0;
 
-void * battery_status_update(void * cookie) {
+#ifdef BATTERY_IO_URING
+    for (; i < n; i += BATTERY_RING_ENTRIES) {
+        int chunk = n - i;
+        if (chunk > BATTERY_RING_ENTRIES)
+            chunk = BATTERY_RING_ENTRIES;
+        if (battery_ring_read(reads + i, chunk) < 0)
+            break;
+    }
+#endif
+    for (; i < n; i++)
+        reads[i].count = readFromPath(reads[i].path, reads[i].buf, reads[i].size);
+}
+
+// Convert an attribute value to its PowerSupplyStatus[] form.  An
+// empty value (a failed read) gives 0, or Unknown for status/health.
+static int parseField(struct PowerSupply* supply, enum gFieldID fieldID,
+        const char* value) {
+    switch (fieldID) {
+        case mAcOnline:
+        case mUsbOnline:
+        case mBatteryPresent:
+            return value[0] == '1';
+        case mBatteryStatus:
+            return value[0] ? getBatteryStatus(value) : gConstants.statusUnknown;
+        case mBatteryHealth:
+            return value[0] ? getBatteryHealth(value) : gConstants.healthUnknown;
+        case mBatteryVoltage:
+            return atoi(value) / supply->voltageDivisor;
+        default:
+            return atoi(value);
+    }
+}
+
+static void setField(struct PowerSupply* supply, enum gFieldID fieldID) {
     const int SIZE = 128;
     char buf[SIZE];
+
+    if (readFromPath(&supply->paths[fieldID], buf, SIZE) <= 0)
+        buf[0] = '\0';
+    supply->value[fieldID] = parseField(supply, fieldID, buf);
+}
+
+// Store every field carried by one supply's uevent file.  Lines are
+// split in place, so nothing is allocated.  Returns the FIELD_BIT()
+// mask of the fields that were updated.
+static unsigned int parseUevent(struct PowerSupply* supply, char* buf) {
+    unsigned int found = 0;
+    char* line = buf;
     int i;
 
-    for (; !is_exit; ) {
-        pthread_mutex_lock(&gBatteryMutex);
+    while (*line) {
+        char* end = strchr(line, '\n');
+        if (end)
+            *end = '\0';
 
-        setBooleanField(gPaths.acOnlinePath, mAcOnline);
-        setBooleanField(gPaths.usbOnlinePath, mUsbOnline);
-        setBooleanField(gPaths.batteryPresentPath, mBatteryPresent);
+        if (!strncmp(line, UEVENT_KEY_PREFIX, sizeof(UEVENT_KEY_PREFIX) - 1)) {
+            char* key = line + sizeof(UEVENT_KEY_PREFIX) - 1;
+            char* value = strchr(key, '=');
+            if (value) {
+                *value++ = '\0';
+                if (!strcmp(key, "CHARGE_FULL")) {
+                    supply->chargeFull = atoi(value);
+                    supply->extras |= EXTRA_CHARGE_FULL;
+                } else if (!strcmp(key, "CHARGE_COUNTER")) {
+                    supply->chargeCounter = atoi(value);
+                    supply->extras |= EXTRA_CHARGE_COUNTER;
+                } else if (!strcmp(key, "CURRENT_NOW")) {
+                    supply->currentNow = atoi(value);
+                    supply->extras |= EXTRA_CURRENT_NOW;
+                }
+                for (i = 0; i < mBatteryEnd; i++) {
+                    if (!supply->keys[i][0])
+                        continue;
+                    if (!strcmp(key, supply->keys[i])) {
+                        supply->value[i] = parseField(supply, i, value);
+                        found |= FIELD_BIT(i);
+                    }
+                }
+            }
+        }
+
+        if (!end)
+            break;
+        line = end + 1;
+    }
+    return found;
+}
 
-        setIntField(gPaths.batteryCapacityPath, mBatteryLevel);
-        setVoltageField(gPaths.batteryVoltagePath, mBatteryVoltage);
-        setIntField(gPaths.batteryTemperaturePath, mBatteryTemperature);
+static unsigned int readUevent(struct PowerSupply* supply) {
+    char buf[UEVENT_FILE_LEN];
 
-        if (readFromFile(gPaths.batteryStatusPath, buf, SIZE) > 0)
-            setInt(mBatteryStatus, getBatteryStatus(buf));
-        else
-            setInt(mBatteryStatus,
-                    gConstants.statusUnknown);
+    if (!supply->uevent.path ||
+            readFromPath(&supply->uevent, buf, sizeof(buf)) <= 0)
+        return 0;
+    return parseUevent(supply, buf);
+}
+
+// Re-read the fields in 'mask' of every supply in 'supplies' (a mask
+// of gSupplies[] indexes).  A supply's uevent file is read once if any
+// of its wanted fields is exported there, which refreshes all of them
+// as a side effect; the uevent files and the remaining attribute files
+// are read as one batch.  Returns the mask of fields that were
+// actually refreshed.
+// Should only be called with gBatteryMutex locked.
+static unsigned int battery_refresh_locked(unsigned int mask, unsigned int supplies) {
+    static char ueventBuf[MAX_POWER_SUPPLIES][UEVENT_FILE_LEN];
+    static char fieldBuf[MAX_POWER_SUPPLIES][mBatteryEnd][128];
+    static struct BatteryRead reads[MAX_POWER_SUPPLIES * (mBatteryEnd + 1)];
+    int supplyRead[MAX_POWER_SUPPLIES];
+    int fieldRead[MAX_POWER_SUPPLIES][mBatteryEnd];
+    unsigned int done = 0;
+    int i, j, n = 0;
+
+    gRefreshSyscalls = 0;
+
+    for (j = 0; j < gNrSupplies; j++) {
+        struct PowerSupply* supply = &gSupplies[j];
+        unsigned int want = mask & supply->fields & ~FIELD_BIT(mBatteryTechnology);
+
+        supplyRead[j] = -1;
+        for (i = 0; i < mBatteryEnd; i++)
+            fieldRead[j][i] = -1;
+        if (supply->removed || !(supplies & (1u << j)))
+            continue;
+
+        for (i = 0; i < mBatteryEnd; i++) {
+            if (!(want & FIELD_BIT(i)))
+                continue;
+
+            if (!supply->keys[i][0]) {
+                reads[n].path = &supply->paths[i];
+                reads[n].buf = fieldBuf[j][i];
+                reads[n].size = sizeof(fieldBuf[j][i]);
+                fieldRead[j][i] = n++;
+            } else if (supplyRead[j] < 0) {
+                reads[n].path = &supply->uevent;
+                reads[n].buf = ueventBuf[j];
+                reads[n].size = sizeof(ueventBuf[j]);
+                supplyRead[j] = n++;
+            }
+        }
+    }
+
+    readBatch(reads, n);
+
+    for (j = 0; j < gNrSupplies; j++) {
+        struct PowerSupply* supply = &gSupplies[j];
+        unsigned int want = mask & supply->fields & ~FIELD_BIT(mBatteryTechnology);
+        unsigned int got = 0;
+
+        if (supply->removed || !(supplies & (1u << j)))
+            continue;
+
+        if (supplyRead[j] >= 0 && reads[supplyRead[j]].count > 0)
+            got |= parseUevent(supply, ueventBuf[j]);
+
+        for (i = 0; i < mBatteryEnd; i++) {
+            if (!(want & FIELD_BIT(i)) || (got & FIELD_BIT(i)))
+                continue;
+            if (fieldRead[j][i] >= 0) {
+                supply->value[i] = parseField(supply, i,
+                        reads[fieldRead[j][i]].count > 0 ? fieldBuf[j][i] : "");
+            } else {
+                // The uevent file failed to deliver it; read it on its own.
+                setField(supply, i);
+            }
+            got |= FIELD_BIT(i);
+        }
+        done |= got;
+    }
+    return done;
+}
+
+static int statusRank(int status) {
+    if (status == gConstants.statusCharging) return 4;
+    if (status == gConstants.statusDischarging) return 3;
+    if (status == gConstants.statusNotCharging) return 2;
+    if (status == gConstants.statusFull) return 1;
+    return 0;
+}
+
+static int healthRank(int health) {
+    if (health == gConstants.healthDead) return 6;
+    if (health == gConstants.healthOverVoltage) return 5;
+    if (health == gConstants.healthOverheat) return 4;
+    if (health == gConstants.healthCold) return 3;
+    if (health == gConstants.healthUnspecifiedFailure) return 2;
+    if (health == gConstants.healthUnknown) return 1;
+    return 0;
+}
+
+// Combine every registered supply into PowerSupplyStatus[]: a charger
+// type is online if any of its supplies is, capacity is weighted by
+// charge_full (equal weights unless every battery reports it), status
+// is Charging if any battery charges, and health, voltage and
+// temperature report the worst battery.
+// Should only be called with gBatteryMutex locked.
+static void battery_aggregate_locked(void) {
+    long long level = 0, weight = 0;
+    int weighted = 1;
+    int batteries = 0;
+    int status = gConstants.statusUnknown;
+    int health = gConstants.healthUnknown;
+    int i;
 
-        if (readFromFile(gPaths.batteryHealthPath, buf, SIZE) > 0)
-            setInt(mBatteryHealth, getBatteryHealth(buf));
+    PowerSupplyStatus[mAcOnline] = 0;
+    PowerSupplyStatus[mUsbOnline] = 0;
+    PowerSupplyStatus[mBatteryPresent] = 0;
+    PowerSupplyStatus[mBatteryLevel] = 0;
+    PowerSupplyStatus[mBatteryVoltage] = 0;
+    PowerSupplyStatus[mBatteryTemperature] = 0;
 
-        pthread_mutex_unlock(&gBatteryMutex);
-        usleep(100000/ PROGRESSBAR_INDETERMINATE_FPS);
-        if (cookie)
+    for (i = 0; i < gNrSupplies; i++) {
+        struct PowerSupply* supply = &gSupplies[i];
+        if (!supply->removed && supply->type == SUPPLY_BATTERY && supply->chargeFull <= 0)
+            weighted = 0;
+    }
+
+    for (i = 0; i < gNrSupplies; i++) {
+        struct PowerSupply* supply = &gSupplies[i];
+        int* v = supply->value;
+
+        if (supply->removed)
+            continue;
+
+        if (supply->type != SUPPLY_BATTERY) {
+            PowerSupplyStatus[mAcOnline] |= v[mAcOnline];
+            PowerSupplyStatus[mUsbOnline] |= v[mUsbOnline];
+            continue;
+        }
+
+        PowerSupplyStatus[mBatteryPresent] |= v[mBatteryPresent];
+        level += (long long)v[mBatteryLevel] * (weighted ? supply->chargeFull : 1);
+        weight += weighted ? supply->chargeFull : 1;
+
+        if (!batteries || statusRank(v[mBatteryStatus]) > statusRank(status))
+            status = v[mBatteryStatus];
+        if (!batteries || healthRank(v[mBatteryHealth]) > healthRank(health))
+            health = v[mBatteryHealth];
+        if (!batteries || v[mBatteryVoltage] < PowerSupplyStatus[mBatteryVoltage])
+            PowerSupplyStatus[mBatteryVoltage] = v[mBatteryVoltage];
+        if (!batteries || v[mBatteryTemperature] > PowerSupplyStatus[mBatteryTemperature])
+            PowerSupplyStatus[mBatteryTemperature] = v[mBatteryTemperature];
+        batteries++;
+    }
+
+    if (weight > 0)
+        PowerSupplyStatus[mBatteryLevel] = (int)((level + weight / 2) / weight);
+    PowerSupplyStatus[mBatteryStatus] = status;
+    PowerSupplyStatus[mBatteryHealth] = health;
+}
+
+/* Time-to-full model, updated in O(1) per refresh from values that
+ * were read anyway.  With charge_counter, charge_full and current_now
+ * on every battery the remaining charge is divided by a smoothed
+ * current; otherwise a least-squares line is fitted to the last
+ * TTF_WINDOW capacity steps, kept as running sums.
+ */
+#define TTF_WINDOW 8
+#define TTF_MAX_MINUTES (99 * 60 + 59)
+
+static struct {
+    long long start_ms;
+    double t[TTF_WINDOW];
+    double y[TTF_WINDOW];
+    int n, head;
+    double st, sy, stt, sty;
+    int level;
+    double current;             /* uA, exponentially smoothed */
+} gTtf;
+
+static int gTimeToFull = -1;
+
+static void ttf_reset(void) {
+    memset(&gTtf, 0, sizeof(gTtf));
+    gTtf.level = -1;
+}
+
+static void ttf_add(double t, double y) {
+    if (gTtf.n == TTF_WINDOW) {
+        double ot = gTtf.t[gTtf.head], oy = gTtf.y[gTtf.head];
+        gTtf.st -= ot;
+        gTtf.sy -= oy;
+        gTtf.stt -= ot * ot;
+        gTtf.sty -= ot * oy;
+    } else {
+        gTtf.n++;
+    }
+    gTtf.t[gTtf.head] = t;
+    gTtf.y[gTtf.head] = y;
+    gTtf.head = (gTtf.head + 1) % TTF_WINDOW;
+    gTtf.st += t;
+    gTtf.sy += y;
+    gTtf.stt += t * t;
+    gTtf.sty += t * y;
+}
+
+// Return the estimated minutes to full, 0 once full, or -1 when not
+// charging or there is not enough history yet.
+// Should only be called with gBatteryMutex locked.
+static int battery_estimate_locked(long long now) {
+    long long full = 0, counter = 0, current = 0;
+    int level = PowerSupplyStatus[mBatteryLevel];
+    int coulomb = 0;
+    double minutes = -1;
+    int i;
+
+    if (PowerSupplyStatus[mBatteryStatus] != gConstants.statusCharging) {
+        ttf_reset();
+        return PowerSupplyStatus[mBatteryStatus] == gConstants.statusFull ? 0 : -1;
+    }
+    if (gTtf.level < 0)
+        gTtf.start_ms = now;
+
+    for (i = 0; i < gNrSupplies; i++) {
+        struct PowerSupply* supply = &gSupplies[i];
+        if (supply->removed || supply->type != SUPPLY_BATTERY)
+            continue;
+        coulomb = (supply->extras & EXTRA_COULOMB) == EXTRA_COULOMB;
+        if (!coulomb)
             break;
+        full += supply->chargeFull;
+        counter += supply->chargeCounter;
+        current += supply->currentNow;
     }
-    return NULL;
+
+    if (coulomb && current > 0) {
+        gTtf.current = gTtf.current > 0 ?
+                gTtf.current * 0.75 + current * 0.25 : current;
+        // Top-off can run past charge_full while still Charging.
+        minutes = (full > counter ? full - counter : 0) * 60.0 / gTtf.current;
+    } else {
+        if (level != gTtf.level)
+            ttf_add((now - gTtf.start_ms) / 1000.0, level);
+        if (gTtf.n >= 2) {
+            double d = gTtf.n * gTtf.stt - gTtf.st * gTtf.st;
+            double slope = d > 0 ? (gTtf.n * gTtf.sty - gTtf.st * gTtf.sy) / d : 0;
+            if (slope > 0)
+                minutes = (100 - level) / slope / 60.0;
+        }
+    }
+    gTtf.level = level;
+
+    if (minutes < 0)
+        return -1;
+    return minutes > TTF_MAX_MINUTES ? TTF_MAX_MINUTES : (int)(minutes + 0.5);
 }
 
-int battery_status_init(void) {
-    char    path[PATH_MAX];
-    struct dirent* entry;
+static long long now_ms(void) {
+    struct timespec ts;
 
-    DIR* dir = opendir(POWER_SUPPLY_PATH);
-    if (dir == NULL) {
-        LOGE("Could not open %s\n", POWER_SUPPLY_PATH);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Adapt the interval of every field in 'mask' to how its value moved
+// since the previous read, and schedule its next read.
+static void battery_schedule(unsigned int mask, long long now) {
+    int i;
+
+    for (i = 0; i < mBatteryEnd; i++) {
+        struct FieldSchedule* f = &gSchedule[i];
+        int value = PowerSupplyStatus[i];
+        int delta = value - f->last_value;
+
+        if (!f->min_ms || !(mask & FIELD_BIT(i)))
+            continue;
+
+        if (!f->interval_ms) {
+            f->interval_ms = f->min_ms;
+        } else if (i == mBatteryTemperature && delta > 0 &&
+                value >= BATTERY_TEMP_WARN) {
+            f->interval_ms = f->min_ms;
+        } else if (abs(delta) >= f->trend_delta) {
+            f->interval_ms /= 2;
+            if (f->interval_ms < f->min_ms)
+                f->interval_ms = f->min_ms;
+        } else {
+            f->interval_ms *= 2;
+            if (f->interval_ms > f->max_ms)
+                f->interval_ms = f->max_ms;
+        }
+        f->last_value = value;
+        f->due_ms = now + f->interval_ms;
+    }
+}
+
+// Return the fields that are due at 'now', including those that would
+// come due within a quarter of their interval, and set *timeout_ms to
+// the time left until the earliest field that is not.  Fields that no
+// registered supply carries are never read, so they are left out.
+static unsigned int battery_due(long long now, int* timeout_ms) {
+    unsigned int carried = 0, mask = 0;
+    long long next = -1;
+    int i;
+
+    for (i = 0; i < gNrSupplies; i++) {
+        if (!gSupplies[i].removed)
+            carried |= gSupplies[i].fields;
+    }
+
+    for (i = 0; i < mBatteryEnd; i++) {
+        struct FieldSchedule* f = &gSchedule[i];
+
+        if (!f->min_ms || !(carried & FIELD_BIT(i)))
+            continue;
+        if (f->due_ms - now <= f->interval_ms / 4)
+            mask |= FIELD_BIT(i);
+        else if (next < 0 || f->due_ms < next)
+            next = f->due_ms;
+    }
+
+    if (timeout_ms)
+        *timeout_ms = next < 0 ? -1 : (int)(next - now);
+    return mask;
+}
+
+// Publish PowerSupplyStatus[] to lock-free readers.  The generation
+// only moves when a value actually changed.  Every publish is offered
+// to telemetry_record(), which decides whether it is worth a sample.
+// Should only be called with gBatteryMutex locked.
+static void battery_publish_locked(void) {
+    unsigned int seq = atomic_load_explicit(&gStateSeq, memory_order_relaxed);
+    int changed = memcmp(gState.field, PowerSupplyStatus, sizeof(gState.field));
+
+    atomic_store_explicit(&gStateSeq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(gState.field, PowerSupplyStatus, sizeof(gState.field));
+    gState.time_to_full = gTimeToFull;
+    clock_gettime(CLOCK_MONOTONIC, &gState.timestamp);
+    if (changed)
+        gState.generation++;
+
+    atomic_store_explicit(&gStateSeq, seq + 2, memory_order_release);
+
+    telemetry_record(&gState);
+}
+
+static int uevent_open_socket(void) {
+    struct sockaddr_nl addr;
+    int sz = UEVENT_RCVBUF_SIZE;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 0xffffffff;
+
+    fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        LOGE("Could not open uevent socket: %s\n", strerror(errno));
         return -1;
     }
-    while ((entry = readdir(dir))) {
-        const char* name = entry->d_name;
 
-        // ignore "." and ".."
-        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        LOGE("Could not bind uevent socket: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int findSupply(const char* name) {
+    int i;
+
+    for (i = 0; i < gNrSupplies; i++)
+        if (!strcmp(gSupplies[i].name, name))
+            return i;
+    return -1;
+}
+
+// Close and forget every path of a supply whose device went away.  The
+// slot stays allocated so that the supply keeps its index if it comes
+// back.
+static void releaseSupply(struct PowerSupply* supply) {
+    int i;
+
+    for (i = 0; i < mBatteryEnd; i++) {
+        closePath(&supply->paths[i]);
+        free(supply->paths[i].path);
+        supply->paths[i].path = NULL;
+        supply->keys[i][0] = '\0';
+    }
+    closePath(&supply->uevent);
+    free(supply->uevent.path);
+    supply->uevent.path = NULL;
+    supply->fields = 0;
+    supply->removed = 1;
+    memset(supply->value, 0, sizeof(supply->value));
+}
+
+static int registerSupply(const char* name);
+
+// Drain the uevent socket and return the mask of gSupplies[] indexes
+// whose power_supply device reported a change.  "add" registers a new
+// supply, "remove" releases it; a message that cannot be tied to one
+// supply marks all of them.
+static unsigned int uevent_power_supply_changed(int fd) {
+    char msg[UEVENT_MSG_LEN + 2];
+    unsigned int changed = 0;
+
+    for (;;) {
+        ssize_t n = recv(fd, msg, UEVENT_MSG_LEN, MSG_DONTWAIT);
+        if (n <= 0)
+            break;
+        if (n >= UEVENT_MSG_LEN)    /* overflow -- discard */
             continue;
-        }
 
-        char buf[20];
-        // Look for "type" file in each subdirectory
-        snprintf(path, sizeof(path), "%s/%s/type", POWER_SUPPLY_PATH, name);
-        int length = readFromFile(path, buf, sizeof(buf));
-        if (length > 0) {
-            if (buf[length - 1] == '\n')
-                buf[length - 1] = 0;
-
-            if (strcmp(buf, "Mains") == 0) {
-                snprintf(path, sizeof(path), "%s/%s/online", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.acOnlinePath = strdup(path);
-            } else if (strcmp(buf, "USB") == 0) {
-                snprintf(path, sizeof(path), "%s/%s/online", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.usbOnlinePath = strdup(path);
-            } else if (strcmp(buf, "Battery") == 0) {
-                snprintf(path, sizeof(path), "%s/%s/status", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.batteryStatusPath = strdup(path);
-                snprintf(path, sizeof(path), "%s/%s/health", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.batteryHealthPath = strdup(path);
-                snprintf(path, sizeof(path), "%s/%s/present", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.batteryPresentPath = strdup(path);
-                snprintf(path, sizeof(path), "%s/%s/capacity", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.batteryCapacityPath = strdup(path);
-
-                snprintf(path, sizeof(path), "%s/%s/voltage_now", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0) {
-                    gPaths.batteryVoltagePath = strdup(path);
-                    // voltage_now is in microvolts, not millivolts
-                    gVoltageDivisor = 1000;
-                } else {
-                    snprintf(path, sizeof(path), "%s/%s/batt_vol", POWER_SUPPLY_PATH, name);
-                    if (access(path, R_OK) == 0)
-                        gPaths.batteryVoltagePath = strdup(path);
-                }
+        msg[n] = '\0';
+        msg[n + 1] = '\0';
 
-                snprintf(path, sizeof(path), "%s/%s/temp", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0) {
-                    gPaths.batteryTemperaturePath = strdup(path);
-                } else {
-                    snprintf(path, sizeof(path), "%s/%s/batt_temp", POWER_SUPPLY_PATH, name);
-                    if (access(path, R_OK) == 0)
-                        gPaths.batteryTemperaturePath = strdup(path);
-                }
+        const char *action = "", *name = NULL, *devpath = NULL;
+        int power_supply = 0;
+        const char *cp = msg;
+        while (*cp) {
+            if (!strcmp(cp, POWER_SUPPLY_SUBSYSTEM))
+                power_supply = 1;
+            else if (!strncmp(cp, "ACTION=", 7))
+                action = cp + 7;
+            else if (!strncmp(cp, "POWER_SUPPLY_NAME=", 18))
+                name = cp + 18;
+            else if (!strncmp(cp, "DEVPATH=", 8))
+                devpath = cp + 8;
+            /* advance to after the next \0 */
+            while (*cp++)
+                ;
+        }
+        if (!power_supply)
+            continue;
+
+        if (!name && devpath && strrchr(devpath, '/'))
+            name = strrchr(devpath, '/') + 1;
+        if (!name) {
+            changed = SUPPLIES_ALL;
+            continue;
+        }
 
-                snprintf(path, sizeof(path), "%s/%s/technology", POWER_SUPPLY_PATH, name);
-                if (access(path, R_OK) == 0)
-                    gPaths.batteryTechnologyPath = strdup(path);
+        int i = findSupply(name);
+        if (!strcmp(action, "remove")) {
+            if (i >= 0 && !gSupplies[i].removed) {
+                LOGD("power_supply %s removed\n", name);
+                releaseSupply(&gSupplies[i]);
+                changed |= 1u << i;
             }
+            continue;
         }
+        if (i < 0 || gSupplies[i].removed)
+            i = registerSupply(name);
+        if (i >= 0)
+            changed |= 1u << i;
     }
-    closedir(dir);
+    return changed;
+}
+
+// Refresh 'mask' of 'supplies', publish the result and reschedule.
+static void battery_pass(unsigned int mask, unsigned int supplies) {
+    pthread_mutex_lock(&gBatteryMutex);
+    mask = battery_refresh_locked(mask, supplies);
+    battery_aggregate_locked();
+    gTimeToFull = battery_estimate_locked(now_ms());
+    battery_publish_locked();
+    battery_schedule(mask, now_ms());
+    pthread_mutex_unlock(&gBatteryMutex);
+}
+
+// Refresh every field of every supply once.
+void * battery_status_update(void * cookie) {
+    battery_pass(FIELD_ALL, SUPPLIES_ALL);
+    return NULL;
+}
+
+static int gBatteryTimer = -1;
+
+// Arm the loop timer for the next field that comes due.
+static void battery_arm_timer(void) {
+    int timeout;
+
+    if (battery_due(now_ms(), &timeout))
+        timeout = 0;
+    if (timeout < 0)
+        loop_timer_cancel(gBatteryTimer);
+    else
+        loop_timer_arm(gBatteryTimer, timeout);
+}
+
+static void battery_on_timer(void *data) {
+    unsigned int mask = battery_due(now_ms(), NULL);
+
+    if (mask)
+        battery_pass(mask, SUPPLIES_ALL);
+    battery_arm_timer();
+}
+
+// A uevent only re-reads the supplies it names.
+static void battery_on_uevent(int fd, uint32_t events, void *data) {
+    unsigned int supplies;
+
+    pthread_mutex_lock(&gBatteryMutex);
+    supplies = uevent_power_supply_changed(fd);
+    pthread_mutex_unlock(&gBatteryMutex);
+    if (supplies) {
+        battery_pass(FIELD_ALL, supplies);
+        battery_arm_timer();
+    }
+}
+
+// Hook the uevent socket and the field schedule into the event loop.
+int battery_loop_init(void) {
+    // Fields inside a quarter of their interval are already pulled in
+    // by battery_due(); the slack lets the timer share a wakeup too.
+    gBatteryTimer = loop_add_timer(battery_on_timer, NULL, 0, 250);
+    if (gBatteryTimer < 0)
+        return -1;
+    if (gUeventFd >= 0)
+        loop_add_fd(gUeventFd, battery_on_uevent, NULL);
+    battery_arm_timer();
+    return 0;
+}
+
+// Remember the attribute file 'attr' of a supply as fieldID if it
+// exists, and the uevent key the same value is exported under (the
+// upper-cased file name).  Returns 0 if the file was taken.
+static int setPath(struct PowerSupply* supply, enum gFieldID fieldID, const char* attr) {
+    char path[PATH_MAX];
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", POWER_SUPPLY_PATH, supply->name, attr);
+    if (access(path, R_OK) != 0)
+        return -1;
+
+    supply->paths[fieldID].path = strdup(path);
+    supply->paths[fieldID].fd = -1;
+    supply->fields |= FIELD_BIT(fieldID);
+
+    if (fieldID == mBatteryTechnology)
+        return 0;
+    for (i = 0; attr[i] && i < UEVENT_KEY_MAX - 1; i++)
+        supply->keys[fieldID][i] = toupper((unsigned char)attr[i]);
+    supply->keys[fieldID][i] = '\0';
+    return 0;
+}
+
+// Check which fields the supply's uevent file really carries.  Fields
+// that are missing go back to per-attribute reads, and a uevent file
+// that carries none of our fields is not read at all.
+static void probeUevent(struct PowerSupply* supply, int* nr_fields, int* nr_uevent) {
+    char path[PATH_MAX];
+    unsigned int found;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s/uevent", POWER_SUPPLY_PATH, supply->name);
+    supply->uevent.fd = -1;
+    if (access(path, R_OK) == 0)
+        supply->uevent.path = strdup(path);
+
+    found = readUevent(supply);
+    for (i = 0; i < mBatteryEnd; i++) {
+        if (!supply->keys[i][0])
+            continue;
+        (*nr_fields)++;
+        if (found & FIELD_BIT(i))
+            (*nr_uevent)++;
+        else
+            supply->keys[i][0] = '\0';
+    }
+
+    if (!found && supply->uevent.path) {
+        closePath(&supply->uevent);
+        free(supply->uevent.path);
+        supply->uevent.path = NULL;
+    }
+}
+
+static int supplyType(const char* type, enum PowerSupplyType* out) {
+    if (!strcmp(type, "USB")) {
+        *out = SUPPLY_USB;
+    } else if (!strcmp(type, "Mains") || !strcmp(type, "Wireless") ||
+            !strncmp(type, "USB_", 4)) {
+        // Dedicated chargers (USB_DCP, USB_CDP, USB_C, USB_PD...) are
+        // reported as AC, as the framework does.
+        *out = SUPPLY_AC;
+    } else if (!strcmp(type, "Battery")) {
+        *out = SUPPLY_BATTERY;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int gUeventFields, gUeventHits;
 
-    if (!gPaths.acOnlinePath)
-        LOGE("acOnlinePath not found");
-    if (!gPaths.usbOnlinePath)
-        LOGE("usbOnlinePath not found");
-    if (!gPaths.batteryStatusPath)
-        LOGE("batteryStatusPath not found");
-    if (!gPaths.batteryHealthPath)
-        LOGE("batteryHealthPath not found");
-    if (!gPaths.batteryPresentPath)
-        LOGE("batteryPresentPath not found");
-    if (!gPaths.batteryCapacityPath)
-        LOGE("batteryCapacityPath not found");
-    if (!gPaths.batteryVoltagePath)
-        LOGE("batteryVoltagePath not found");
-    if (!gPaths.batteryTemperaturePath)
-        LOGE("batteryTemperaturePath not found");
-    if (!gPaths.batteryTechnologyPath)
-        LOGE("batteryTechnologyPath not found");
+// Add the power_supply directory 'name' to gSupplies[], or bring a
+// removed one back.  Returns its index, or -1 if it is not a charger
+// or battery.
+static int registerSupply(const char* name) {
+    char path[PATH_MAX];
+    char buf[20];
+    enum PowerSupplyType type;
+    struct PowerSupply* supply;
+    int i, field;
+
+    snprintf(path, sizeof(path), "%s/%s/type", POWER_SUPPLY_PATH, name);
+    int length = readFromFile(path, buf, sizeof(buf));
+    if (length <= 0)
+        return -1;
+    if (buf[length - 1] == '\n')
+        buf[length - 1] = 0;
+    if (supplyType(buf, &type) < 0)
+        return -1;
+
+    i = findSupply(name);
+    if (i < 0) {
+        if (gNrSupplies >= MAX_POWER_SUPPLIES) {
+            LOGE("too many power supplies, ignoring %s\n", name);
+            return -1;
+        }
+        i = gNrSupplies++;
+    } else if (!gSupplies[i].removed) {
+        return i;
+    }
+
+    supply = &gSupplies[i];
+    memset(supply, 0, sizeof(*supply));
+    for (field = 0; field < mBatteryEnd; field++)
+        supply->paths[field].fd = -1;
+    supply->uevent.fd = -1;
+    snprintf(supply->name, sizeof(supply->name), "%s", name);
+    supply->type = type;
+    supply->voltageDivisor = 1;
+
+    if (type == SUPPLY_AC) {
+        setPath(supply, mAcOnline, "online");
+    } else if (type == SUPPLY_USB) {
+        setPath(supply, mUsbOnline, "online");
+    } else {
+        setPath(supply, mBatteryStatus, "status");
+        setPath(supply, mBatteryHealth, "health");
+        setPath(supply, mBatteryPresent, "present");
+        setPath(supply, mBatteryLevel, "capacity");
+
+        // voltage_now is in microvolts, not millivolts
+        if (setPath(supply, mBatteryVoltage, "voltage_now") == 0)
+            supply->voltageDivisor = 1000;
+        else
+            setPath(supply, mBatteryVoltage, "batt_vol");
+
+        if (setPath(supply, mBatteryTemperature, "temp") < 0)
+            setPath(supply, mBatteryTemperature, "batt_temp");
+
+        setPath(supply, mBatteryTechnology, "technology");
+
+        char full[20];
+        snprintf(path, sizeof(path), "%s/%s/charge_full", POWER_SUPPLY_PATH, name);
+        if (readFromFile(path, full, sizeof(full)) > 0)
+            supply->chargeFull = atoi(full);
+    }
+
+    probeUevent(supply, &gUeventFields, &gUeventHits);
+    if (type == SUPPLY_BATTERY)
+        LOGD("power_supply %s: time to full from %s\n", name,
+                (supply->extras & EXTRA_COULOMB) == EXTRA_COULOMB ?
+                "charge_counter/current_now" : "capacity trend");
+    LOGD("power_supply %s registered as %s\n", name, buf);
+    return i;
+}
+
+int battery_status_init(void) {
+    struct dirent* entry;
+    unsigned int fields = 0;
+    int i;
 
     gConstants.statusUnknown = BATTERY_STATUS_UNKNOWN;
     gConstants.statusCharging = BATTERY_STATUS_CHARGING;
@@ -324,70 +1351,97 @@ int battery_status_init(void) {
     gConstants.healthOverVoltage = BATTERY_HEALTH_OVER_VOLTAGE;
     gConstants.healthUnspecifiedFailure = BATTERY_HEALTH_UNSPECIFIED_FAILURE;
 
+#ifdef BATTERY_IO_URING
+    battery_ring_init();
+#endif
+
+    DIR* dir = opendir(POWER_SUPPLY_PATH);
+    if (dir == NULL) {
+        LOGE("Could not open %s\n", POWER_SUPPLY_PATH);
+        return -1;
+    }
+    while ((entry = readdir(dir))) {
+        const char* name = entry->d_name;
+
+        // ignore "." and ".."
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+            continue;
+        }
+        registerSupply(name);
+    }
+    closedir(dir);
+
+    for (i = 0; i < gNrSupplies; i++)
+        fields |= gSupplies[i].fields;
+    for (i = 0; i < mBatteryEnd; i++) {
+        if (!(fields & FIELD_BIT(i)))
+            LOGE("%s not found", gPathNames[i]);
+    }
+    LOGD("%d of %d battery fields refreshed from uevent files\n",
+            gUeventHits, gUeventFields);
+
+    gUeventFd = uevent_open_socket();
+    ttf_reset();
+
     int temp;
     battery_status_update((void *)&temp);
     return 0;
 }
 
-int battery_ac_online(void) {
-    int ret;
+void battery_snapshot(struct battery_state *out) {
+    unsigned int seq;
 
-    pthread_mutex_lock(&gBatteryMutex);
-    setBooleanField(gPaths.acOnlinePath, mAcOnline);
-    ret = PowerSupplyStatus[mAcOnline];
-    pthread_mutex_unlock(&gBatteryMutex);
-    return ret;
+    do {
+        seq = atomic_load_explicit(&gStateSeq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy(out, &gState, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq & 1 ||
+             seq != atomic_load_explicit(&gStateSeq, memory_order_relaxed));
 }
-int battery_usb_online(void) {
-    int ret;
 
-    pthread_mutex_lock(&gBatteryMutex);
-    setBooleanField(gPaths.usbOnlinePath, mUsbOnline);
-    ret = PowerSupplyStatus[mUsbOnline];
-    pthread_mutex_unlock(&gBatteryMutex);
-    return ret;
+unsigned int battery_generation(void) {
+    unsigned int seq, generation;
+
+    do {
+        seq = atomic_load_explicit(&gStateSeq, memory_order_acquire);
+        generation = gState.generation;
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq & 1 ||
+             seq != atomic_load_explicit(&gStateSeq, memory_order_relaxed));
+    return generation;
 }
-int battery_capacity(void) {
-    int ret;
 
-    pthread_mutex_lock(&gBatteryMutex);
+static int battery_field(enum gFieldID fieldID) {
+    unsigned int seq;
+    int value;
 
-    setIntField(gPaths.batteryCapacityPath, mBatteryLevel);
-    ret = PowerSupplyStatus[mBatteryLevel];
-    pthread_mutex_unlock(&gBatteryMutex);
-    return ret;
+    do {
+        seq = atomic_load_explicit(&gStateSeq, memory_order_acquire);
+        value = gState.field[fieldID];
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq & 1 ||
+             seq != atomic_load_explicit(&gStateSeq, memory_order_relaxed));
+    return value;
 }
 
-int battery_status(void) {
-    int ret;
-    const int SIZE = 128;
-    char buf[SIZE];
-
-    pthread_mutex_lock(&gBatteryMutex);
-    if (readFromFile(gPaths.batteryStatusPath, buf, SIZE) > 0)
-        setInt(mBatteryStatus, getBatteryStatus(buf));
-    else
-        setInt(mBatteryStatus, gConstants.statusUnknown);
+int battery_ac_online(void) {
+    return battery_field(mAcOnline);
+}
+int battery_usb_online(void) {
+    return battery_field(mUsbOnline);
+}
+int battery_capacity(void) {
+    return battery_field(mBatteryLevel);
+}
 
-    ret = PowerSupplyStatus[mBatteryStatus];
-    pthread_mutex_unlock(&gBatteryMutex);
-    return ret;
+int battery_status(void) {
+    return battery_field(mBatteryStatus);
 }
 
 
 int battery_health(void)
 {
-        int ret;
-        const int SIZE = 128;
-        char buf[SIZE];
-
-        pthread_mutex_lock(&gBatteryMutex);
-        if (readFromFile(gPaths.batteryHealthPath, buf, SIZE) > 0)
-                setInt(mBatteryHealth, getBatteryHealth(buf));
-        else
-                setInt(mBatteryHealth, gConstants.healthUnknown);
-
-        ret = PowerSupplyStatus[mBatteryHealth];
-        pthread_mutex_unlock(&gBatteryMutex);
-        return ret;
-}
\ No newline at end of file
+        return battery_field(mBatteryHealth);
+}
@@ -32,8 +32,23 @@ enum gFieldID{
     mBatteryEnd,
 };
 
+#include <time.h>
+
+// Consistent copy of every gFieldID value.  generation is bumped each
+// time any field changes, so callers can compare it against the value
+// they last acted on and skip work when nothing moved.
+struct battery_state {
+    int field[mBatteryEnd];
+    struct timespec timestamp;      // CLOCK_MONOTONIC time of the last refresh
+    unsigned int generation;
+    int time_to_full;               // minutes, 0 when full, -1 when unknown
+};
+
 extern int battery_status_init(void);
 extern  void * battery_status_update(void * cookie);
+extern int battery_loop_init(void);
+extern void battery_snapshot(struct battery_state *out);
+extern unsigned int battery_generation(void);
 extern int battery_ac_online(void);
 extern int battery_usb_online(void);
 extern int battery_capacity(void);
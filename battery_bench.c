@@ -0,0 +1,289 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+/*
+ * Sysfs cost of a battery refresh, on a Linux host or a device.
+ *
+ * Builds a fake power_supply tree (a Mains charger, a USB port and a
+ * battery) in a temporary directory, points battery.c at it and prints
+ * the syscalls a full refresh issues: cold, right after every attribute
+ * descriptor was closed, and cached, with the descriptors kept open.
+ * Cached refreshes are then timed, once with pread() and once batched
+ * on the io_uring if the kernel has one.  The open/read/close per
+ * attribute that refreshes used to do is shown as the baseline.
+ *
+ * Last, the field schedule is checked: right after a full refresh no
+ * field may be due, or the loop timer would be armed for 0 ms and spin.
+ *
+ *   charge_battery_bench [-a] [-m] [-v] [-n refreshes]
+ *
+ * -a leaves the uevent files out, so every field is read from its own
+ * attribute file.  -m builds a board with no Mains charger and a
+ * battery without a present file, so some fields have no supply at
+ * all.  -v sends battery.c's log to stderr.  Exits 1 if the schedule
+ * check fails.
+ *
+ * battery.c is compiled into this file so its registry, ring and
+ * syscall counter can be reached without a backdoor in the real API.
+ */
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdarg.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static char gBenchRoot[256];
+#define POWER_SUPPLY_PATH gBenchRoot
+
+#include "battery.c"
+
+#define BENCH_REFRESHES 2000
+
+static int gVerbose = 0;
+static int gRefreshes = BENCH_REFRESHES;
+
+/* Stand-ins for the rest of the app. */
+
+void log_write(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if (!gVerbose)
+        return;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void telemetry_record(const struct battery_state *state) {}
+
+int loop_add_fd(int fd, loop_fd_cb cb, void *data) { return 0; }
+int loop_add_timer(loop_timer_cb cb, void *data, int period_ms, int slack_ms) { return 0; }
+void loop_timer_arm(int id, int delay_ms) {}
+void loop_timer_cancel(int id) {}
+
+static const struct {
+    const char *supply;
+    const char *attr;
+    const char *value;
+} bench_attrs[] = {
+    { "ac", "type", "Mains" },
+    { "ac", "online", "1" },
+    { "usb", "type", "USB" },
+    { "usb", "online", "0" },
+    { "battery", "type", "Battery" },
+    { "battery", "status", "Charging" },
+    { "battery", "health", "Good" },
+    { "battery", "present", "1" },
+    { "battery", "capacity", "57" },
+    { "battery", "voltage_now", "3912000" },
+    { "battery", "temp", "312" },
+    { "battery", "technology", "Li-ion" },
+    { "battery", "charge_full", "3000000" },
+    { "battery", "charge_counter", "1710000" },
+    { "battery", "current_now", "1500000" },
+};
+
+#define BENCH_NR_ATTRS (int)(sizeof(bench_attrs) / sizeof(bench_attrs[0]))
+
+static int write_file(const char *dir, const char *name, const char *value) {
+    char path[PATH_MAX];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "%s\n", value);
+    fclose(f);
+    return 0;
+}
+
+// One directory per supply, each attribute in its own file and, unless
+// 'attrs_only', all of them again as POWER_SUPPLY_<ATTR>=<value> lines
+// in the supply's uevent file.  'minimal' leaves out the Mains charger
+// and the battery's present file.
+static int make_tree(int attrs_only, int minimal) {
+    const char *supplies[] = { "ac", "usb", "battery" };
+    char dir[PATH_MAX], uevent[UEVENT_FILE_LEN];
+    int i, j;
+
+    snprintf(gBenchRoot, sizeof(gBenchRoot), "%s/charge_battery_bench.XXXXXX",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(gBenchRoot)) {
+        fprintf(stderr, "cannot create %s: %s\n", gBenchRoot, strerror(errno));
+        return -1;
+    }
+
+    for (j = 0; j < 3; j++) {
+        int len = snprintf(uevent, sizeof(uevent), "POWER_SUPPLY_NAME=%s", supplies[j]);
+
+        if (minimal && !strcmp(supplies[j], "ac"))
+            continue;
+        snprintf(dir, sizeof(dir), "%s/%s", gBenchRoot, supplies[j]);
+        if (mkdir(dir, 0755) < 0)
+            return -1;
+        for (i = 0; i < BENCH_NR_ATTRS; i++) {
+            const char *attr = bench_attrs[i].attr;
+            int k;
+
+            if (strcmp(bench_attrs[i].supply, supplies[j]))
+                continue;
+            if (minimal && !strcmp(attr, "present"))
+                continue;
+            if (write_file(dir, attr, bench_attrs[i].value) < 0)
+                return -1;
+            len += snprintf(uevent + len, sizeof(uevent) - len, "\n" UEVENT_KEY_PREFIX);
+            for (k = 0; attr[k]; k++)
+                uevent[len++] = toupper((unsigned char)attr[k]);
+            len += snprintf(uevent + len, sizeof(uevent) - len, "=%s", bench_attrs[i].value);
+        }
+        if (!attrs_only && write_file(dir, "uevent", uevent) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+// Close every descriptor battery.c keeps, so the next refresh is cold.
+static void close_paths(void) {
+    int i, j;
+
+    for (j = 0; j < gNrSupplies; j++) {
+        for (i = 0; i < mBatteryEnd; i++)
+            closePath(&gSupplies[j].paths[i]);
+        closePath(&gSupplies[j].uevent);
+    }
+}
+
+// What a refresh used to cost: open, read and close every attribute
+// file battery.c registered.
+static void baseline_refresh(void) {
+    char buf[128];
+    int i, j;
+
+    gRefreshSyscalls = 0;
+    for (j = 0; j < gNrSupplies; j++) {
+        for (i = 0; i < mBatteryEnd; i++) {
+            if (i == mBatteryTechnology || !gSupplies[j].paths[i].path)
+                continue;
+            readFromFile(gSupplies[j].paths[i].path, buf, sizeof(buf));
+            gRefreshSyscalls += 3;
+        }
+    }
+}
+
+static void battery_refresh(void) {
+    battery_status_update(NULL);
+}
+
+// Print the cold and cached syscalls of 'refresh' and the percentiles
+// of gRefreshes cached runs.
+static void bench(const char *name, void (*refresh)(void), long long *samples) {
+    int i, cold, cached;
+
+    close_paths();
+    refresh();
+    cold = gRefreshSyscalls;
+    refresh();
+    cached = gRefreshSyscalls;
+
+    for (i = 0; i < gRefreshes; i++) {
+        long long start = now_ns();
+        refresh();
+        samples[i] = now_ns() - start;
+    }
+    qsort(samples, gRefreshes, sizeof(long long), cmp_ll);
+    printf("%-16s %6d %6d %9.1f %9.1f %9.1f\n", name, cold, cached,
+           samples[gRefreshes / 2] / 1e3, samples[(gRefreshes - 1) * 90 / 100] / 1e3,
+           samples[(gRefreshes - 1) * 99 / 100] / 1e3);
+}
+
+// Nothing may come due straight after a full refresh, whatever fields
+// the tree lacks.
+static int check_schedule(void) {
+    unsigned int due;
+    int timeout;
+
+    battery_status_update(NULL);
+    due = battery_due(now_ms(), &timeout);
+    printf("schedule: next poll in %d ms, due now 0x%x: %s\n", timeout, due,
+           due || timeout == 0 ? "FAIL" : "ok");
+    return due || timeout == 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int opt, attrs_only = 0, minimal = 0, ret;
+    long long *samples;
+
+    while ((opt = getopt(argc, argv, "amvn:")) != -1) {
+        switch (opt) {
+        case 'a':
+            attrs_only = 1;
+            break;
+        case 'm':
+            minimal = 1;
+            break;
+        case 'v':
+            gVerbose = 1;
+            break;
+        case 'n':
+            gRefreshes = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-a] [-m] [-v] [-n refreshes]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (gRefreshes <= 0)
+        gRefreshes = 1;
+    samples = calloc(gRefreshes, sizeof(long long));
+    if (!samples)
+        return 1;
+
+    if (make_tree(attrs_only, minimal) < 0 || battery_status_init() < 0) {
+        nftw(gBenchRoot, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+        return 1;
+    }
+
+    printf("%d supplies, %s%s, %d refreshes\n", gNrSupplies,
+           attrs_only ? "attribute files only" : "uevent files",
+           minimal ? ", no Mains and no present file" : "", gRefreshes);
+    printf("%-16s %6s %6s %9s %9s %9s\n", "refresh", "cold", "cached",
+           "p50 us", "p90 us", "p99 us");
+    bench("open/read/close", baseline_refresh, samples);
+#ifdef BATTERY_IO_URING
+    int ring = gRing.fd;
+
+    gRing.fd = -1;
+    bench("pread", battery_refresh, samples);
+    gRing.fd = ring;
+    if (ring < 0)
+        printf("%-16s no io_uring on this kernel\n", "io_uring");
+    else
+        bench("io_uring", battery_refresh, samples);
+    if (ring >= 0 && gRing.fd < 0)
+        printf("io_uring failed during the run; timings fell back to pread\n");
+#else
+    bench("pread", battery_refresh, samples);
+#endif
+    ret = check_schedule();
+
+    nftw(gBenchRoot, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    return ret < 0 ? 1 : 0;
+}
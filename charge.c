@@ -34,6 +34,8 @@
 #include "minui/minui.h"
 #include "recovery_ui.h"
 #include "battery.h"
+#include "telemetry.h"
+#include "loop.h"
 #include <linux/rtc.h>
 #include <sys/time.h>
 
@@ -44,9 +46,7 @@
 #define RTC_DEV_FILE		"/dev/rtc0"
 
 extern pthread_mutex_t gBatteryMutex;
-void *charge_thread(void *cookie);
-void *power_thread(void *cookie);
-void *input_thread(void *write_fd);
+void ui_loop_init(void);
 void backlight_init(void);
 int is_exit = 0;
 int chip_version = 0;
@@ -141,6 +141,10 @@ main(int argc,  char **argv) {
 
     validate_rtc_time();
 
+    // Only charging sessions are recorded, so this comes after the
+    // bootmode check.
+    telemetry_init();
+
     ui_init();
 
     LOGD("ui_init\n");
@@ -148,29 +152,18 @@ main(int argc,  char **argv) {
     ui_set_background(BACKGROUND_ICON_NONE);
     ui_show_indeterminate_progress();
     backlight_init();
-    pthread_t t_1,  t_2,  t_3;
-    ret = pthread_create(&t_1,  NULL,  charge_thread,  NULL);
+    // Battery, screen, power and input work all run from one event
+    // loop so that their wakeups line up.
+    ret = loop_init();
     if (ret) {
-        LOGE("thread:charge_thread creat failed\n");
+        LOGE("event loop init failed\n");
         return -1;
     }
-    ret = pthread_create(&t_2,  NULL,  input_thread,  NULL);
-    if (ret) {
-        LOGE("thread:input_thread creat failed\n");
-        return -1;
-    }
-
-    ret = pthread_create(&t_3,  NULL,  power_thread,  NULL);
-    if (ret) {
-        LOGE("thread: power_thread creat failed\n");
-        return -1;
-    }
-
-    LOGD("all thread start\n");
+    battery_loop_init();
+    ui_loop_init();
 
-    pthread_join(t_1,  NULL);
-    pthread_join(t_2,  NULL);
-    pthread_join(t_3,  NULL);
+    LOGD("event loop start\n");
+    loop_run();
 
     LOGD("charge app exit\n");
 
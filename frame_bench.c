@@ -0,0 +1,391 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+/*
+ * Charging screen frame times and pixel regression check, on a Linux
+ * host, through the headless minui backend.
+ *
+ * For each resolution res_pixel_identify() knows, a child process
+ * brings up the real ui.c on the mem backend at that size and:
+ *
+ *   draws a fixed list of scenes (percentages, time to full, the
+ *   animated bar, an error icon) with MINUI_MEM_DUMP set, and the
+ *   PPM of every flipped frame is hashed and compared with the
+ *   golden file;
+ *
+ *   animates the charging bar for -n frames with nothing dumped, and
+ *   the gaps between the flip times mem_flip_times() returns are
+ *   printed as percentiles, i.e. the cost of one draw_progress_locked()
+ *   frame.
+ *
+ *   charge_frame_bench [-n frames] [-s WxH] [-g] [-k] [-v]
+ *
+ * -s runs one size only.  -g rewrites the golden file instead of
+ * checking it, after a deliberate change to the screen.  -k keeps the
+ * dumped frames and prints where.  -v lets the app log to stderr.
+ * Exits 1 if any frame differs from its golden hash.
+ */
+#define _GNU_SOURCE
+#include <ftw.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <linux/reboot.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "ui.c"
+#include "minui/graphics.h"
+
+#ifndef FRAME_GOLDEN
+#define FRAME_GOLDEN "frame_bench.golden"
+#endif
+
+#define BENCH_FRAMES 200
+#define GOLDEN_MAX 256
+
+static const struct {
+    int width;
+    int height;
+} bench_sizes[] = {
+    { 360, 640 },
+    { 480, 800 },
+    { 720, 1280 },
+    { 1080, 1920 },
+    { 1440, 2560 },
+};
+
+#define BENCH_NR_SIZES (int)(sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+// What the screen is asked to show, in order; each one is a flip.
+static const struct {
+    int type;
+    int level;
+    int time_to_full;
+    int error;
+} bench_scenes[] = {
+    { PROGRESSBAR_TYPE_NORMAL, 5, -1, 0 },
+    { PROGRESSBAR_TYPE_NORMAL, 57, -1, 0 },
+    { PROGRESSBAR_TYPE_NORMAL, 100, -1, 0 },
+    { PROGRESSBAR_TYPE_INDETERMINATE, 57, 42, 0 },
+    { PROGRESSBAR_TYPE_INDETERMINATE, 57, 42, 0 },
+    { PROGRESSBAR_TYPE_INDETERMINATE, 58, 41, 0 },
+    { PROGRESSBAR_TYPE_INDETERMINATE, 9, 725, 0 },
+    { PROGRESSBAR_TYPE_INDETERMINATE, 99, 1, 0 },
+    { PROGRESSBAR_TYPE_NORMAL, 57, -1, 1 },
+    { PROGRESSBAR_TYPE_NORMAL, 57, -1, 3 },
+};
+
+#define BENCH_NR_SCENES (int)(sizeof(bench_scenes) / sizeof(bench_scenes[0]))
+
+int is_exit = 0;
+int chip_version = 0;
+
+static int gVerbose = 0;
+static int gFrames = BENCH_FRAMES;
+
+static struct {
+    char name[64];
+    uint64_t hash;
+} gGolden[GOLDEN_MAX];
+static int gNrGolden;
+
+/* Stand-ins for the parts of the app that touch hardware. */
+
+void log_write(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if (!gVerbose)
+        return;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void backlight_on(void) {}
+void backlight_off(void) {}
+void led_on(int color) {}
+void led_off(void) {}
+int autosuspend_enable(void) { return 0; }
+int autosuspend_disable(void) { return 0; }
+
+void battery_snapshot(struct battery_state *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+unsigned int battery_generation(void) {
+    return 0;
+}
+
+// Only the headless backend exists here.
+minui_backend *open_adf(void) { return NULL; }
+minui_backend *open_drm(void) { return NULL; }
+minui_backend *open_fbdev(void) { return NULL; }
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+// FNV-1a over the whole PPM file, header included.
+static int hash_file(const char *path, uint64_t *hash) {
+    unsigned char buf[65536];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t n, i;
+    FILE *f = fopen(path, "rb");
+
+    if (!f)
+        return -1;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        for (i = 0; i < n; i++) {
+            h ^= buf[i];
+            h *= 0x100000001b3ULL;
+        }
+    }
+    fclose(f);
+    *hash = h;
+    return 0;
+}
+
+static void load_golden(void) {
+    char line[128];
+    FILE *f = fopen(FRAME_GOLDEN, "r");
+
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", FRAME_GOLDEN, strerror(errno));
+        return;
+    }
+    while (fgets(line, sizeof(line), f) && gNrGolden < GOLDEN_MAX) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%63s %" SCNx64, gGolden[gNrGolden].name,
+                   &gGolden[gNrGolden].hash) == 2)
+            gNrGolden++;
+    }
+    fclose(f);
+}
+
+static int find_golden(const char *name, uint64_t *hash) {
+    int i;
+
+    for (i = 0; i < gNrGolden; i++) {
+        if (!strcmp(gGolden[i].name, name)) {
+            *hash = gGolden[i].hash;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Bring ui.c up on the mem backend at 'width' x 'height', as charge.c
+// does.  gr_init() reports the backend on stdout; keep that and the
+// image loading noise out of the results unless -v.
+static void bench_ui_init(int width, int height, const char *dump) {
+    char size[32];
+    int out = dup(STDOUT_FILENO), err = dup(STDERR_FILENO);
+
+    snprintf(size, sizeof(size), "%dx%d", width, height);
+    setenv("MINUI_BACKEND", "mem", 1);
+    setenv("MINUI_MEM_SIZE", size, 1);
+    if (dump)
+        setenv("MINUI_MEM_DUMP", dump, 1);
+    else
+        unsetenv("MINUI_MEM_DUMP");
+
+    fflush(stdout);
+    if (!gVerbose) {
+        freopen("/dev/null", "w", stdout);
+        dup2(STDOUT_FILENO, STDERR_FILENO);     // and libpng's warnings
+    }
+    ui_init();
+    ui_set_background(BACKGROUND_ICON_NONE);
+    ui_show_indeterminate_progress();
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    close(out);
+    close(err);
+}
+
+// Child: draw every scene once, each flip dumped into 'dump'.
+static int run_scenes(int width, int height, const char *dump) {
+    int i;
+
+    bench_ui_init(width, height, dump);
+    for (i = 0; i < BENCH_NR_SCENES; i++) {
+        gProgressBarType = bench_scenes[i].type;
+        gTimeToFull = bench_scenes[i].time_to_full;
+        status_index = bench_scenes[i].error;
+        update_progress_locked(bench_scenes[i].level);
+    }
+    return 0;
+}
+
+// Child: animate the charging bar and print the flip to flip times.
+static int run_frames(int width, int height) {
+    long long *times = calloc(gFrames + 1, sizeof(long long));
+    int i, n;
+
+    if (!times)
+        return 1;
+    bench_ui_init(width, height, NULL);
+    gProgressBarType = PROGRESSBAR_TYPE_INDETERMINATE;
+    gTimeToFull = 42;
+    for (i = 0; i <= gFrames; i++)
+        update_progress_locked(57);
+
+    n = mem_flip_times(times, gFrames + 1);
+    for (i = 1; i < n; i++)
+        times[i - 1] = times[i] - times[i - 1];
+    n--;
+    if (n <= 0)
+        return 1;
+    qsort(times, n, sizeof(long long), cmp_ll);
+    printf("%4dx%-5d %6d %9.1f %9.1f %9.1f %9.1f\n", width, height, n,
+           times[n / 2] / 1e3, times[(n - 1) * 90 / 100] / 1e3,
+           times[(n - 1) * 99 / 100] / 1e3, times[n - 1] / 1e3);
+    return 0;
+}
+
+static int run_child(int (*fn)(int, int, const char *), int width, int height,
+                     const char *dump) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int ret = fn(width, height, dump);
+        fflush(stdout);
+        _exit(ret);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        return -1;
+    return 0;
+}
+
+static int run_frames_child(int width, int height, const char *dump) {
+    return run_frames(width, height);
+}
+
+// Hash every frame dumped for one size, then check or record it.
+// Returns the number of frames that differ from their golden hash.
+static int check_frames(int width, int height, const char *dump, FILE *golden) {
+    char path[PATH_MAX], name[64];
+    uint64_t hash, want;
+    int frame, bad = 0;
+
+    for (frame = 0; ; frame++) {
+        snprintf(path, sizeof(path), "%s/frame_%05u.ppm", dump, frame);
+        if (hash_file(path, &hash) < 0)
+            break;
+        snprintf(name, sizeof(name), "%dx%d/%05d", width, height, frame);
+        if (golden) {
+            fprintf(golden, "%s %016" PRIx64 "\n", name, hash);
+        } else if (find_golden(name, &want) < 0) {
+            fprintf(stderr, "%s: no golden hash\n", name);
+            bad++;
+        } else if (want != hash) {
+            fprintf(stderr, "%s: %016" PRIx64 ", golden %016" PRIx64 "\n", name, hash, want);
+            bad++;
+        }
+    }
+    if (!frame) {
+        fprintf(stderr, "%dx%d: no frames dumped\n", width, height);
+        bad++;
+    }
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    char dump[PATH_MAX];
+    const char *only = NULL;
+    int opt, i, bad = 0, regen = 0, keep = 0;
+    FILE *golden = NULL;
+
+    while ((opt = getopt(argc, argv, "n:s:gkv")) != -1) {
+        switch (opt) {
+        case 'n':
+            gFrames = atoi(optarg);
+            break;
+        case 's':
+            only = optarg;
+            break;
+        case 'g':
+            regen = 1;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        case 'v':
+            gVerbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-s WxH] [-g] [-k] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (gFrames <= 0)
+        gFrames = 1;
+
+    if (regen) {
+        golden = fopen(FRAME_GOLDEN, "w");
+        if (!golden) {
+            fprintf(stderr, "%s: %s\n", FRAME_GOLDEN, strerror(errno));
+            return 1;
+        }
+        fprintf(golden, "# FNV-1a of each PPM charge_frame_bench dumps; "
+                "regenerate with charge_frame_bench -g\n");
+    } else {
+        load_golden();
+    }
+
+    printf("%-10s %6s %9s %9s %9s %9s  (us per frame)\n", "size", "frames",
+           "p50", "p90", "p99", "max");
+    for (i = 0; i < BENCH_NR_SIZES; i++) {
+        int width = bench_sizes[i].width, height = bench_sizes[i].height;
+        char size[32];
+        int diff;
+
+        snprintf(size, sizeof(size), "%dx%d", width, height);
+        if (only && strcmp(only, size))
+            continue;
+
+        snprintf(dump, sizeof(dump), "%s/charge_frame_bench.XXXXXX",
+                 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+        if (!mkdtemp(dump)) {
+            fprintf(stderr, "%s: %s\n", dump, strerror(errno));
+            return 1;
+        }
+        if (run_child(run_scenes, width, height, dump) < 0) {
+            fprintf(stderr, "%s: drawing the scenes failed\n", size);
+            bad++;
+        }
+        diff = check_frames(width, height, dump, golden);
+        bad += diff;
+        if (keep || diff)
+            fprintf(stderr, "%s: frames kept in %s\n", size, dump);
+        else
+            nftw(dump, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+
+        if (run_child(run_frames_child, width, height, NULL) < 0) {
+            fprintf(stderr, "%s: timing failed\n", size);
+            bad++;
+        }
+    }
+
+    if (golden) {
+        fclose(golden);
+        printf("golden hashes written to %s\n", FRAME_GOLDEN);
+    } else {
+        printf("%s\n", bad ? "FRAMES DIFFER" : "all frames match golden");
+    }
+    return bad ? 1 : 0;
+}
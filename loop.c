@@ -0,0 +1,240 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "common.h"
+#include "loop.h"
+
+#define MAX_LOOP_FDS 24
+#define MAX_LOOP_TIMERS 8
+#define LOOP_STATS_MS 60000
+
+struct loop_fd {
+    int fd;
+    loop_fd_cb cb;
+    void *data;
+};
+
+struct loop_timer {
+    loop_timer_cb cb;
+    void *data;
+    int period_ms;
+    int slack_ms;
+    long long due_ms;           /* -1 while disarmed */
+};
+
+static int gEpollFd = -1;
+static int gTimerFd = -1;
+static struct loop_fd gFds[MAX_LOOP_FDS];
+static int gNrFds;
+static struct loop_timer gTimers[MAX_LOOP_TIMERS];
+static int gNrTimers;
+
+// Wakeups since the last stats line, split by what caused them.
+static unsigned int gWakeups, gTimerWakeups, gFdWakeups;
+static long long gStatsStart;
+
+extern int is_exit;
+
+static long long loop_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int loop_init(void) {
+    struct epoll_event ev;
+
+    gEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (gEpollFd < 0) {
+        LOGE("epoll_create1 failed: %s\n", strerror(errno));
+        return -1;
+    }
+    gTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (gTimerFd < 0) {
+        LOGE("timerfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;         /* NULL marks the timerfd */
+    if (epoll_ctl(gEpollFd, EPOLL_CTL_ADD, gTimerFd, &ev) < 0) {
+        LOGE("epoll_ctl timerfd failed: %s\n", strerror(errno));
+        return -1;
+    }
+    gStatsStart = loop_now_ms();
+    return 0;
+}
+
+int loop_add_fd(int fd, loop_fd_cb cb, void *data) {
+    struct epoll_event ev;
+
+    if (gNrFds >= MAX_LOOP_FDS) {
+        LOGE("too many loop fds\n");
+        return -1;
+    }
+    gFds[gNrFds].fd = fd;
+    gFds[gNrFds].cb = cb;
+    gFds[gNrFds].data = data;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &gFds[gNrFds];
+    if (epoll_ctl(gEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOGE("epoll_ctl fd %d failed: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    gNrFds++;
+    return 0;
+}
+
+int loop_add_timer(loop_timer_cb cb, void *data, int period_ms, int slack_ms) {
+    struct loop_timer *t;
+
+    if (gNrTimers >= MAX_LOOP_TIMERS) {
+        LOGE("too many loop timers\n");
+        return -1;
+    }
+    t = &gTimers[gNrTimers];
+    t->cb = cb;
+    t->data = data;
+    t->period_ms = period_ms;
+    t->slack_ms = slack_ms;
+    t->due_ms = period_ms > 0 ? loop_now_ms() + period_ms : -1;
+    return gNrTimers++;
+}
+
+void loop_timer_arm(int id, int delay_ms) {
+    if (id >= 0 && id < gNrTimers)
+        gTimers[id].due_ms = loop_now_ms() + (delay_ms > 0 ? delay_ms : 0);
+}
+
+void loop_timer_set_slack(int id, int slack_ms) {
+    if (id >= 0 && id < gNrTimers)
+        gTimers[id].slack_ms = slack_ms;
+}
+
+void loop_timer_cancel(int id) {
+    if (id >= 0 && id < gNrTimers)
+        gTimers[id].due_ms = -1;
+}
+
+// Program the timerfd for the earliest due time, so a timer with
+// nothing to share its wakeup with runs on time.  The wake is only
+// pushed later, up to the earliest due + slack, when that lets the
+// window [due - slack, due + slack] of another timer open first and
+// both run on one wakeup.  Returns that time, or -1 when no timer is
+// armed.
+static long long loop_arm_timerfd(void) {
+    struct itimerspec its;
+    long long wake = -1, deadline = -1;
+    int i;
+
+    for (i = 0; i < gNrTimers; i++) {
+        struct loop_timer *t = &gTimers[i];
+        if (t->due_ms < 0)
+            continue;
+        if (wake < 0 || t->due_ms < wake)
+            wake = t->due_ms;
+        if (deadline < 0 || t->due_ms + t->slack_ms < deadline)
+            deadline = t->due_ms + t->slack_ms;
+    }
+    // Every window open at 'wake' is still open at 'deadline', so the
+    // latest opening before it merges the most timers.
+    for (i = 0; i < gNrTimers; i++) {
+        struct loop_timer *t = &gTimers[i];
+        long long open = t->due_ms - t->slack_ms;
+        if (t->due_ms >= 0 && open > wake && open <= deadline)
+            wake = open;
+    }
+
+    memset(&its, 0, sizeof(its));
+    if (wake >= 0) {
+        its.it_value.tv_sec = wake / 1000;
+        its.it_value.tv_nsec = (wake % 1000) * 1000000;
+        if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+            its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(gTimerFd, TFD_TIMER_ABSTIME, &its, NULL);
+    return wake;
+}
+
+// Run every timer whose window [due - slack, due + slack] has opened.
+static void loop_run_timers(void) {
+    long long now = loop_now_ms();
+    int i;
+
+    for (i = 0; i < gNrTimers && !is_exit; i++) {
+        struct loop_timer *t = &gTimers[i];
+        if (t->due_ms < 0 || t->due_ms - t->slack_ms > now)
+            continue;
+
+        if (t->period_ms > 0) {
+            t->due_ms += t->period_ms;
+            if (t->due_ms <= now)
+                t->due_ms = now + t->period_ms;
+        } else {
+            t->due_ms = -1;
+        }
+        t->cb(t->data);
+    }
+}
+
+static void loop_stats(long long now) {
+    long long elapsed = now - gStatsStart;
+
+    if (elapsed < LOOP_STATS_MS)
+        return;
+    LOGD("event loop: %u.%02u wakeups/s (%u timer, %u fd) over %lld s\n",
+            (unsigned int)(gWakeups * 1000LL / elapsed),
+            (unsigned int)(gWakeups * 100000LL / elapsed % 100),
+            gTimerWakeups, gFdWakeups, elapsed / 1000);
+    gWakeups = gTimerWakeups = gFdWakeups = 0;
+    gStatsStart = now;
+}
+
+void loop_run(void) {
+    struct epoll_event events[MAX_LOOP_FDS + 1];
+    uint64_t expirations;
+    int i, n;
+
+    while (!is_exit) {
+        loop_arm_timerfd();
+
+        n = epoll_wait(gEpollFd, events, MAX_LOOP_FDS + 1, -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                LOGE("epoll_wait failed: %s\n", strerror(errno));
+                usleep(100000);
+            }
+            continue;
+        }
+
+        gWakeups++;
+        for (i = 0; i < n && !is_exit; i++) {
+            struct loop_fd *f = events[i].data.ptr;
+            if (!f) {
+                // EAGAIN: the timerfd was re-armed since it fired.
+                if (read(gTimerFd, &expirations, sizeof(expirations)) ==
+                        sizeof(expirations))
+                    gTimerWakeups++;
+                else if (errno != EAGAIN)
+                    LOGE("timerfd read failed: %s\n", strerror(errno));
+                continue;
+            }
+            gFdWakeups++;
+            f->cb(f->fd, events[i].events, f->data);
+        }
+
+        // Timers that are inside their window run now as well, even
+        // if an fd caused this wakeup.
+        loop_run_timers();
+        loop_stats(loop_now_ms());
+    }
+}
@@ -0,0 +1,29 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+
+#ifndef LOOP_H_
+#define LOOP_H_
+
+#include <stdint.h>
+
+/* Single-threaded event loop: fds are multiplexed with epoll and all
+ * timers share one timerfd.  A timer may run up to 'slack_ms' before
+ * or after its due time, so timers that come due close together are
+ * run from the same wakeup.
+ */
+typedef void (*loop_fd_cb)(int fd, uint32_t events, void *data);
+typedef void (*loop_timer_cb)(void *data);
+
+extern int loop_init(void);
+extern int loop_add_fd(int fd, loop_fd_cb cb, void *data);
+// Returns a timer id.  A non-zero period re-arms the timer after each
+// run; otherwise it stays disarmed until loop_timer_arm().
+extern int loop_add_timer(loop_timer_cb cb, void *data, int period_ms, int slack_ms);
+extern void loop_timer_arm(int id, int delay_ms);
+extern void loop_timer_set_slack(int id, int slack_ms);
+extern void loop_timer_cancel(int id);
+// Dispatch until is_exit is set.
+extern void loop_run(void);
+
+#endif  // LOOP_H_
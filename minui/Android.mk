@@ -2,7 +2,7 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := graphics.c graphics_adf.c graphics_drm.c \
-graphics_fbdev.c events.c resources.c
+graphics_fbdev.c graphics_mem.c raster.c events.c resources.c
 
 LOCAL_C_INCLUDES +=\
     external/libpng\
@@ -25,6 +25,11 @@ ifeq ($(subst ",,$(TARGET_RECOVERY_PIXEL_FORMAT)),BGRA_8888)
   LOCAL_CFLAGS += -DRECOVERY_BGRA
 endif
 
+# Let gr_init() pick the headless backend; see graphics_mem.c.
+ifeq ($(strip $(CHARGE_MINUI_MEM_BACKEND)),true)
+  LOCAL_CFLAGS += -DMINUI_MEM_BACKEND
+endif
+
 ifneq ($(TARGET_RECOVERY_OVERSCAN_PERCENT),)
   LOCAL_CFLAGS += -DOVERSCAN_PERCENT=$(TARGET_RECOVERY_OVERSCAN_PERCENT)
 else
@@ -32,3 +37,23 @@ else
 endif
 
 include $(BUILD_STATIC_LIBRARY)
+
+# Rasterizer microbenchmarks; see raster_bench.c.
+define _minui-raster-bench
+include $$(CLEAR_VARS)
+LOCAL_MODULE := minui_raster_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := raster_bench.c graphics_mem.c raster.c
+LOCAL_C_INCLUDES += external/libpng external/zlib
+LOCAL_CFLAGS += -DOVERSCAN_PERCENT=0
+LOCAL_STATIC_LIBRARIES := libpng libz libcutils
+endef
+
+$(eval $(call _minui-raster-bench))
+LOCAL_VENDOR_MODULE := true
+include $(BUILD_EXECUTABLE)
+
+$(eval $(call _minui-raster-bench))
+include $(BUILD_HOST_EXECUTABLE)
+
+_minui-raster-bench :=
@@ -72,37 +72,47 @@ void ev_exit(void) {
     }
 }
 
+int ev_get_fd(unsigned n) {
+    return n < ev_count ? ev_fds[n].fd : -1;
+}
+
+/* Read one event from device n.  The rtc (device 0) reports an alarm
+ * as KEY_BRL_DOT8.  Returns 0 for a key event, -1 otherwise. */
+int ev_read(unsigned n, struct input_event *ev) {
+    unsigned long alarm_data;
+    int r;
+
+    if (n >= ev_count)
+        return -1;
+    if (n == 0) {
+        r = read(ev_fds[n].fd, &alarm_data, sizeof(alarm_data));
+        LOGD("get form 0 is %lu\n", alarm_data);
+        ev->type = EV_KEY;
+        ev->code = KEY_BRL_DOT8;
+        ev->value = 1;
+        return 0;
+    }
+    r = read(ev_fds[n].fd, ev, sizeof(*ev));
+    if (r == sizeof(*ev) && ev->type == EV_KEY)
+        return 0;
+    return -1;
+}
+
 /* wait: 0 dont wait; -1 wait forever; >0 wait ms */
 int ev_get(struct input_event *ev, int wait_ms) {
     int r;
     unsigned n;
-    unsigned long alarm_data;
 
 	if(wait_ms < 0){
 		LOGE("poll event return\n");
 		return -1;
 	}
- //   do {
-        r = poll(ev_fds, ev_count, wait_ms);
-
-        if (r > 0) {
-            for (n = 0; n < ev_count; n++) {
-                if (ev_fds[n].revents & POLLIN) {
-                    if (n == 0) {
-                        r = read(ev_fds[n].fd, &alarm_data, sizeof(alarm_data));
-                        LOGD("get form 0 is %lu\n", alarm_data);
-                        ev->type = EV_KEY;
-                        ev->code = KEY_BRL_DOT8;
-                        ev->value = 1;
-                        return 0;
-                    } else {
-							r = read(ev_fds[n].fd, ev, sizeof(*ev));
-							if (ev->type == EV_KEY)
-								return 0;
-						}
-					}
-				}
-			}
- //   } while (wait_ms == -1);
+    r = poll(ev_fds, ev_count, wait_ms);
+    if (r > 0) {
+        for (n = 0; n < ev_count; n++) {
+            if ((ev_fds[n].revents & POLLIN) && ev_read(n, ev) == 0)
+                return 0;
+        }
+    }
     return -1;
 }
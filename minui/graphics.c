@@ -34,6 +34,7 @@
 #include "font_10x18.h"
 #include "minui.h"
 #include "graphics.h"
+#include "raster.h"
 #include "../common.h"
 /* SPRD: add for support rotate @{ */
 #include "cutils/properties.h"
@@ -64,8 +65,191 @@ static GRSurface* gr_draw = NULL;
 /* SPRD: add for support rotate @{ */
 static void gr_rotate_180();
 /* @} */
+
+// Rotated panels.  The primitives draw straight into the panel's
+// orientation, so gr_flip() has nothing left to do: pixel (x, y) of the
+// screen is at
+//   FB_ROTATE_UR   (x, y)
+//   FB_ROTATE_CW   (W-1-y, x)
+//   FB_ROTATE_UD   (W-1-x, H-1-y)
+//   FB_ROTATE_CCW  (y, H-1-x)
+// of the W x H buffer, and the screen is H x W when turned on its side.
+// With vendor.charge.rotate_on_flip=1, FB_ROTATE_UD frames are drawn
+// upright and gr_flip() turns each one over in place instead.
+static bool gr_rotate_on_flip = false;
+
+static int draw_rotation(void) {
+    if (rotation == FB_ROTATE_UD && gr_rotate_on_flip)
+        return FB_ROTATE_UR;
+    return rotation;
+}
+
+static bool sideways(void) {
+    return rotation == FB_ROTATE_CW || rotation == FB_ROTATE_CCW;
+}
+
+static int screen_width(void) {
+    return sideways() ? gr_draw->height : gr_draw->width;
+}
+
+static int screen_height(void) {
+    return sideways() ? gr_draw->width : gr_draw->height;
+}
+
 static bool outside(int x, int y) {
-    return x < 0 || x >= gr_draw->width || y < 0 || y >= gr_draw->height;
+    return x < 0 || x >= screen_width() || y < 0 || y >= screen_height();
+}
+
+static unsigned char* pixel_at(int x, int y) {
+    return gr_draw->data + y * gr_draw->row_bytes + x * gr_draw->pixel_bytes;
+}
+
+// Move screen point (*x, *y) into gr_draw.
+static void map_point(int* x, int* y) {
+    int t;
+
+    switch (draw_rotation()) {
+    case FB_ROTATE_CW:
+        t = *x;
+        *x = gr_draw->width - 1 - *y;
+        *y = t;
+        break;
+    case FB_ROTATE_UD:
+        *x = gr_draw->width - 1 - *x;
+        *y = gr_draw->height - 1 - *y;
+        break;
+    case FB_ROTATE_CCW:
+        t = *y;
+        *y = gr_draw->height - 1 - *x;
+        *x = t;
+        break;
+    }
+}
+
+// The byte address of screen pixel (x, y), and the byte distance to its
+// right-hand neighbour (*xstep) and to the one below it (*ystep).
+static unsigned char* map_pixel(int x, int y, int* xstep, int* ystep) {
+    int row = gr_draw->row_bytes, px = gr_draw->pixel_bytes;
+
+    switch (draw_rotation()) {
+    case FB_ROTATE_CW:  *xstep = row;  *ystep = -px;  break;
+    case FB_ROTATE_UD:  *xstep = -px;  *ystep = -row; break;
+    case FB_ROTATE_CCW: *xstep = -row; *ystep = px;   break;
+    default:            *xstep = px;   *ystep = row;  break;
+    }
+    map_point(&x, &y);
+    return pixel_at(x, y);
+}
+
+// Damage of one frame, in gr_fb_width() x gr_fb_height() coordinates.
+typedef struct {
+    bool all;
+    int n;
+    GRRect r[GR_DAMAGE_MAX];
+} GRDamage;
+
+// Frames remembered per buffer; enough for triple buffering.
+#define GR_DAMAGE_HISTORY 4
+
+static GRDamage gr_frame_damage;
+static struct {
+    GRSurface* surface;
+    GRDamage damage;
+} gr_history[GR_DAMAGE_HISTORY];
+static int gr_history_len = 0;
+
+// A finished frame left in gr_draw for the next unblank to flip.
+static bool gr_unblank_flip = false;
+
+static bool gr_clipping = false;
+static GRRect gr_clip_rect;
+
+// Animation clock.  gr_anim_ideal_ns advances by exactly one period per
+// frame so rounding to the refresh grid never accumulates; the frame
+// is aimed at the vsync nearest to it, gr_anim_target_ns.
+static long long gr_anim_period_ns = 0;
+static long long gr_anim_ideal_ns = 0;
+static long long gr_anim_target_ns = 0;
+static long long gr_refresh_ns = 16666667;
+static bool gr_anim_flipped = false;
+static unsigned int gr_anim_frames, gr_anim_late, gr_anim_dropped;
+
+static bool rect_intersect(GRRect* a, const GRRect* b) {
+    int x1 = a->x > b->x ? a->x : b->x;
+    int y1 = a->y > b->y ? a->y : b->y;
+    int x2 = a->x + a->w < b->x + b->w ? a->x + a->w : b->x + b->w;
+    int y2 = a->y + a->h < b->y + b->h ? a->y + a->h : b->y + b->h;
+
+    if (x2 <= x1 || y2 <= y1)
+        return false;
+    a->x = x1;
+    a->y = y1;
+    a->w = x2 - x1;
+    a->h = y2 - y1;
+    return true;
+}
+
+static void rect_union(GRRect* a, const GRRect* b) {
+    int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+    a->x = a->x < b->x ? a->x : b->x;
+    a->y = a->y < b->y ? a->y : b->y;
+    a->w = x2 - a->x;
+    a->h = y2 - a->y;
+}
+
+// Add 'rect' to 'd'.  Overlapping rects are merged, and once the list
+// is full everything collapses into its bounding box.
+static void damage_add(GRDamage* d, const GRRect* rect) {
+    GRRect r = *rect;
+    int i;
+
+    if (d->all)
+        return;
+    for (i = 0; i < d->n; i++) {
+        GRRect overlap = d->r[i];
+        if (rect_intersect(&overlap, &r)) {
+            rect_union(&r, &d->r[i]);
+            d->r[i] = d->r[--d->n];
+            i = -1;     // the grown rect may now overlap earlier ones
+        }
+    }
+    if (d->n == GR_DAMAGE_MAX) {
+        for (i = 1; i < d->n; i++)
+            rect_union(&d->r[0], &d->r[i]);
+        rect_union(&d->r[0], &r);
+        d->n = 1;
+        return;
+    }
+    d->r[d->n++] = r;
+}
+
+static void damage_merge(GRDamage* d, const GRDamage* from) {
+    int i;
+
+    if (from->all)
+        d->all = true;
+    for (i = 0; i < from->n && !d->all; i++)
+        damage_add(d, &from->r[i]);
+}
+
+// Clip a w x h box drawn at (*x, *y) from source offset (*sx, *sy)
+// against the clip rect.  Returns false if nothing is left.
+static bool clip_box(int* x, int* y, int* w, int* h, int* sx, int* sy) {
+    GRRect r = { *x, *y, *w, *h };
+
+    if (!gr_clipping)
+        return *w > 0 && *h > 0;
+    if (!rect_intersect(&r, &gr_clip_rect))
+        return false;
+    if (sx) *sx += r.x - *x;
+    if (sy) *sy += r.y - *y;
+    *x = r.x;
+    *y = r.y;
+    *w = r.w;
+    *h = r.h;
+    return true;
 }
 
 int gr_measure(const char *s) {
@@ -77,31 +261,28 @@ void gr_font_size(int *x, int *y) {
     *y = gr_font->cheight;
 }
 
+// Blend a width x height alpha mask into gr_draw at (x, y), already
+// offset and bounds checked.
 static void text_blend(unsigned char* src_p, int src_row_bytes,
-                       unsigned char* dst_p, int dst_row_bytes,
-                       int width, int height) {
+                       int x, int y, int width, int height) {
+    int step, dst_row_bytes;
+    unsigned char* dst_p = map_pixel(x, y, &step, &dst_row_bytes);
     int i, j;
+
     for (j = 0; j < height; ++j) {
         unsigned char* sx = src_p;
         unsigned char* px = dst_p;
-        for (i = 0; i < width; ++i) {
+        for (i = 0; i < width; ++i, px += step) {
             unsigned char a = *sx++;
             if (gr_current_a < 255) a = ((int)a * gr_current_a) / 255;
             if (a == 255) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
+                px[0] = gr_current_r;
+                px[1] = gr_current_g;
+                px[2] = gr_current_b;
             } else if (a > 0) {
-                *px = (*px * (255-a) + gr_current_r * a) / 255;
-                ++px;
-                *px = (*px * (255-a) + gr_current_g * a) / 255;
-                ++px;
-                *px = (*px * (255-a) + gr_current_b * a) / 255;
-                ++px;
-                ++px;
-            } else {
-                px += 4;
+                px[0] = (px[0] * (255-a) + gr_current_r * a) / 255;
+                px[1] = (px[1] * (255-a) + gr_current_g * a) / 255;
+                px[2] = (px[2] * (255-a) + gr_current_b * a) / 255;
             }
         }
         src_p += src_row_bytes;
@@ -125,13 +306,13 @@ void gr_text(int x, int y, const char *s, int bold) {
     while ((off = *s++)) {
         off -= 32;
         if (outside(x, y) || outside(x+font->cwidth-1, y+font->cheight-1)) break;
-        if (off < 96) {
-            unsigned char* src_p = font->texture->data + (off * font->cwidth) +
-                (bold ? font->cheight * font->texture->row_bytes : 0);
-            unsigned char* dst_p = gr_draw->data + y*gr_draw->row_bytes + x*gr_draw->pixel_bytes;
+        int cx = x - overscan_offset_x, cy = y - overscan_offset_y;
+        int cw = font->cwidth, ch = font->cheight, sx = 0, sy = 0;
+        if (off < 96 && clip_box(&cx, &cy, &cw, &ch, &sx, &sy)) {
+            unsigned char* src_p = font->texture->data + (off * font->cwidth) + sx +
+                (sy + (bold ? font->cheight : 0)) * font->texture->row_bytes;
             text_blend(src_p, font->texture->row_bytes,
-                       dst_p, gr_draw->row_bytes,
-                       font->cwidth, font->cheight);
+                       cx + overscan_offset_x, cy + overscan_offset_y, cw, ch);
         }
         x += font->cwidth;
     }
@@ -150,12 +331,7 @@ void gr_texticon(int x, int y, GRSurface* icon) {
 
     if (outside(x, y) || outside(x+icon->width-1, y+icon->height-1)) return;
 
-    unsigned char* src_p = icon->data;
-    unsigned char* dst_p = gr_draw->data + y*gr_draw->row_bytes + x*gr_draw->pixel_bytes;
-
-    text_blend(src_p, icon->row_bytes,
-               dst_p, gr_draw->row_bytes,
-               icon->width, icon->height);
+    text_blend(icon->data, icon->row_bytes, x, y, icon->width, icon->height);
 }
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
@@ -166,25 +342,63 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
 }
 
 void gr_clear() {
+    if (gr_clipping) {
+        unsigned char a = gr_current_a;
+        gr_current_a = 255;
+        gr_fill(gr_clip_rect.x, gr_clip_rect.y,
+                gr_clip_rect.x + gr_clip_rect.w, gr_clip_rect.y + gr_clip_rect.h);
+        gr_current_a = a;
+        return;
+    }
     if (gr_current_r == gr_current_g &&
         gr_current_r == gr_current_b) {
         memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
     } else {
-        int x, y;
+        int y;
         unsigned char* px = gr_draw->data;
         for (y = 0; y < gr_draw->height; ++y) {
-            for (x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
+            raster->fill(px, gr_draw->width, gr_current_r, gr_current_g, gr_current_b);
+            px += gr_draw->row_bytes;
+        }
+    }
+}
+
+// Fill [x1, x2) x [y1, y2) of gr_draw, already offset and bounds checked.
+static void fill_rect(int x1, int y1, int x2, int y2) {
+    unsigned char* p;
+    int y;
+
+    if (draw_rotation() != FB_ROTATE_UR) {
+        // Map two opposite corners and span the box between them.
+        int ax = x1, ay = y1, bx = x2 - 1, by = y2 - 1;
+        map_point(&ax, &ay);
+        map_point(&bx, &by);
+        x1 = ax < bx ? ax : bx;
+        x2 = (ax < bx ? bx : ax) + 1;
+        y1 = ay < by ? ay : by;
+        y2 = (ay < by ? by : ay) + 1;
+    }
+    p = pixel_at(x1, y1);
+
+    if (gr_current_a == 255) {
+        for (y = y1; y < y2; ++y) {
+            raster->fill(p, x2 - x1, gr_current_r, gr_current_g, gr_current_b);
+            p += gr_draw->row_bytes;
+        }
+    } else if (gr_current_a > 0) {
+        for (y = y1; y < y2; ++y) {
+            raster->blend(p, x2 - x1, gr_current_r, gr_current_g, gr_current_b, gr_current_a);
+            p += gr_draw->row_bytes;
         }
     }
 }
 
 void gr_fill(int x1, int y1, int x2, int y2) {
+    int w = x2 - x1, h = y2 - y1;
+    if (!clip_box(&x1, &y1, &w, &h, NULL, NULL)) return;
+    x2 = x1 + w;
+    y2 = y1 + h;
+
     x1 += overscan_offset_x;
     y1 += overscan_offset_y;
 
@@ -193,34 +407,36 @@ void gr_fill(int x1, int y1, int x2, int y2) {
 
     if (outside(x1, y1) || outside(x2-1, y2-1)) return;
 
-    unsigned char* p = gr_draw->data + y1 * gr_draw->row_bytes + x1 * gr_draw->pixel_bytes;
-    if (gr_current_a == 255) {
-        int x, y;
-        for (y = y1; y < y2; ++y) {
-            unsigned char* px = p;
-            for (x = x1; x < x2; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            p += gr_draw->row_bytes;
-        }
-    } else if (gr_current_a > 0) {
-        int x, y;
-        for (y = y1; y < y2; ++y) {
-            unsigned char* px = p;
-            for (x = x1; x < x2; ++x) {
-                *px = (*px * (255-gr_current_a) + gr_current_r * gr_current_a) / 255;
-                ++px;
-                *px = (*px * (255-gr_current_a) + gr_current_g * gr_current_a) / 255;
-                ++px;
-                *px = (*px * (255-gr_current_a) + gr_current_b * gr_current_a) / 255;
-                ++px;
-                ++px;
-            }
-            p += gr_draw->row_bytes;
+    fill_rect(x1, y1, x2, y2);
+}
+
+// Copy a w x h box of 'source' to gr_draw at (dx, dy), already offset
+// and bounds checked.
+static void blit_rect(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
+    unsigned char* src_p = source->data + sy*source->row_bytes + sx*source->pixel_bytes;
+    int xstep, ystep;
+    unsigned char* dst_p = map_pixel(dx, dy, &xstep, &ystep);
+    int i;
+
+    if (xstep < 0 && ystep < 0) {
+        // Upside down: each row lands reversed, ending at dst_p.
+        dst_p += (w - 1) * xstep;
+        for (i = 0; i < h; ++i) {
+            raster->reverse(dst_p, src_p, w);
+            src_p += source->row_bytes;
+            dst_p += ystep;
         }
+        return;
+    }
+    if (xstep != gr_draw->pixel_bytes) {
+        // On its side: source rows become buffer columns.
+        raster->transpose(dst_p, xstep, ystep, src_p, source->row_bytes, w, h);
+        return;
+    }
+    for (i = 0; i < h; ++i) {
+        memcpy(dst_p, src_p, w * source->pixel_bytes);
+        src_p += source->row_bytes;
+        dst_p += gr_draw->row_bytes;
     }
 }
 
@@ -232,20 +448,74 @@ void gr_blit(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
         return;
     }
 
+    if (outside(dx + overscan_offset_x, dy + overscan_offset_y) ||
+        outside(dx + overscan_offset_x + w - 1, dy + overscan_offset_y + h - 1)) return;
+    if (!clip_box(&dx, &dy, &w, &h, &sx, &sy)) return;
+
     dx += overscan_offset_x;
     dy += overscan_offset_y;
 
 
     if (outside(dx, dy) || outside(dx+w-1, dy+h-1)) return;
+    blit_rect(source, sx, sy, w, h, dx, dy);
+}
+
+// Composite a w x h box of 'source' over gr_draw at (dx, dy), already
+// offset and bounds checked.  Only the part of each row between the
+// transparent ends is touched, and its opaque run is copied.
+static void blend_rect(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
     unsigned char* src_p = source->data + sy*source->row_bytes + sx*source->pixel_bytes;
-    unsigned char* dst_p = gr_draw->data + dy*gr_draw->row_bytes + dx*gr_draw->pixel_bytes;
+    int xstep, ystep;
+    unsigned char* dst_p = map_pixel(dx, dy, &xstep, &ystep);
+    int i, x;
 
-    int i;
-    for (i = 0; i < h; ++i) {
-        memcpy(dst_p, src_p, w * source->pixel_bytes);
-        src_p += source->row_bytes;
-        dst_p += gr_draw->row_bytes;
+    if (source->spans == NULL) {
+        blit_rect(source, sx, sy, w, h, dx, dy);
+        return;
+    }
+    for (i = 0; i < h; ++i, src_p += source->row_bytes, dst_p += ystep) {
+        const GRSpan* span = &source->spans[sy + i];
+        int x0 = span->start > sx ? span->start - sx : 0;
+        int x1 = span->end < sx + w ? span->end - sx : w;
+        int o0 = span->opaque_start - sx, o1 = span->opaque_end - sx;
+
+        if (x1 <= x0)
+            continue;
+        o0 = o0 < x0 ? x0 : o0 > x1 ? x1 : o0;
+        o1 = o1 < o0 ? o0 : o1 > x1 ? x1 : o1;
+        if (xstep != gr_draw->pixel_bytes) {
+            // Rotated: the row doesn't run forwards, go pixel by pixel.
+            for (x = x0; x < x1; ++x) {
+                if (x >= o0 && x < o1)
+                    memcpy(dst_p + x * xstep, src_p + x * 4, 4);
+                else
+                    raster->over(dst_p + x * xstep, src_p + x * 4, 1);
+            }
+            continue;
+        }
+        raster->over(dst_p + x0 * 4, src_p + x0 * 4, o0 - x0);
+        memcpy(dst_p + o0 * 4, src_p + o0 * 4, (o1 - o0) * 4);
+        raster->over(dst_p + o1 * 4, src_p + o1 * 4, x1 - o1);
+    }
+}
+
+void gr_blit_blend(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
+    if (source == NULL)    return;
+
+    if (gr_draw->pixel_bytes != source->pixel_bytes) {
+        printf("gr_blit_blend: source has wrong format\n");
+        return;
     }
+
+    if (outside(dx + overscan_offset_x, dy + overscan_offset_y) ||
+        outside(dx + overscan_offset_x + w - 1, dy + overscan_offset_y + h - 1)) return;
+    if (!clip_box(&dx, &dy, &w, &h, &sx, &sy)) return;
+
+    dx += overscan_offset_x;
+    dy += overscan_offset_y;
+
+    if (outside(dx, dy) || outside(dx+w-1, dy+h-1)) return;
+    blend_rect(source, sx, sy, w, h, dx, dy);
 }
 
 unsigned int gr_get_width(GRSurface* surface) {
@@ -262,6 +532,273 @@ unsigned int gr_get_height(GRSurface* surface) {
     return surface->height;
 }
 
+// One recorded command.  Boxes are in gr_draw coordinates with the
+// overscan offset applied and were checked against the screen when
+// recorded.
+enum {
+    GR_DL_COLOR,
+    GR_DL_FILL,
+    GR_DL_BLIT,
+    GR_DL_BLEND,
+    GR_DL_TEXT,
+};
+
+typedef struct {
+    unsigned char op;
+    unsigned char bold;
+    unsigned char rgba[4];
+    short var;              // index into the replay vars, -1 for none
+    short count;            // entries in 'table'
+    int x, y, w, h;
+    int sx, sy;
+    GRSurface* surface;
+    GRSurface** table;
+    const char* text;
+} GRDrawCmd;
+
+struct GRDisplayList {
+    int n;
+    int capacity;
+    int width;              // gr_draw size the list was checked against
+    int height;
+    GRDrawCmd* cmds;
+};
+
+GRDisplayList* gr_dl_create(int capacity) {
+    GRDisplayList* dl = calloc(1, sizeof(*dl));
+    if (dl == NULL)
+        return NULL;
+    dl->cmds = calloc(capacity, sizeof(*dl->cmds));
+    if (dl->cmds == NULL) {
+        free(dl);
+        return NULL;
+    }
+    dl->capacity = capacity;
+    return dl;
+}
+
+void gr_dl_free(GRDisplayList* dl) {
+    if (dl == NULL)
+        return;
+    free(dl->cmds);
+    free(dl);
+}
+
+void gr_dl_reset(GRDisplayList* dl) {
+    dl->n = 0;
+    dl->width = screen_width();
+    dl->height = screen_height();
+}
+
+// Append a command covering w x h at (x, y) in gr_fb coordinates.
+// Returns NULL if the list is full or the box is not entirely on screen.
+static GRDrawCmd* dl_append(GRDisplayList* dl, int op, int x, int y, int w, int h) {
+    GRDrawCmd* cmd;
+
+    x += overscan_offset_x;
+    y += overscan_offset_y;
+    if (dl->n == dl->capacity) {
+        LOGE("display list full (%d commands)\n", dl->capacity);
+        return NULL;
+    }
+    if (op != GR_DL_COLOR &&
+        (w <= 0 || h <= 0 || outside(x, y) || outside(x+w-1, y+h-1)))
+        return NULL;
+    cmd = &dl->cmds[dl->n++];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->op = op;
+    cmd->var = -1;
+    cmd->x = x;
+    cmd->y = y;
+    cmd->w = w;
+    cmd->h = h;
+    return cmd;
+}
+
+int gr_dl_color(GRDisplayList* dl, unsigned char r, unsigned char g,
+                unsigned char b, unsigned char a) {
+    GRDrawCmd* cmd = dl_append(dl, GR_DL_COLOR, 0, 0, 0, 0);
+    if (cmd == NULL)
+        return -1;
+    cmd->rgba[0] = r;
+    cmd->rgba[1] = g;
+    cmd->rgba[2] = b;
+    cmd->rgba[3] = a;
+    return 0;
+}
+
+int gr_dl_fill(GRDisplayList* dl, int x1, int y1, int x2, int y2) {
+    return dl_append(dl, GR_DL_FILL, x1, y1, x2 - x1, y2 - y1) ? 0 : -1;
+}
+
+static bool dl_source_ok(GRSurface* source, int sx, int sy, int w, int h) {
+    return source != NULL && source->pixel_bytes == gr_draw->pixel_bytes &&
+           sx >= 0 && sy >= 0 && sx + w <= source->width && sy + h <= source->height;
+}
+
+int gr_dl_blit(GRDisplayList* dl, GRSurface* source, int sx, int sy,
+               int w, int h, int dx, int dy) {
+    GRDrawCmd* cmd;
+
+    if (!dl_source_ok(source, sx, sy, w, h))
+        return -1;
+    cmd = dl_append(dl, GR_DL_BLIT, dx, dy, w, h);
+    if (cmd == NULL)
+        return -1;
+    cmd->surface = source;
+    cmd->sx = sx;
+    cmd->sy = sy;
+    return 0;
+}
+
+int gr_dl_blit_blend(GRDisplayList* dl, GRSurface* source, int sx, int sy,
+                     int w, int h, int dx, int dy) {
+    GRDrawCmd* cmd;
+
+    if (!dl_source_ok(source, sx, sy, w, h))
+        return -1;
+    cmd = dl_append(dl, GR_DL_BLEND, dx, dy, w, h);
+    if (cmd == NULL)
+        return -1;
+    cmd->surface = source;
+    cmd->sx = sx;
+    cmd->sy = sy;
+    return 0;
+}
+
+int gr_dl_blit_var(GRDisplayList* dl, GRSurface** table, int count, int var,
+                   int sx, int sy, int w, int h, int dx, int dy) {
+    GRDrawCmd* cmd;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!dl_source_ok(table[i], sx, sy, w, h))
+            return -1;
+    }
+    if (count <= 0 || var < 0)
+        return -1;
+    cmd = dl_append(dl, GR_DL_BLIT, dx, dy, w, h);
+    if (cmd == NULL)
+        return -1;
+    cmd->table = table;
+    cmd->count = count;
+    cmd->var = var;
+    cmd->sx = sx;
+    cmd->sy = sy;
+    return 0;
+}
+
+int gr_dl_text(GRDisplayList* dl, int x, int y, const char* text, int maxlen, int bold) {
+    GRFont* font = gr_font;
+    GRDrawCmd* cmd;
+    int fit;
+
+    if (!font->texture)
+        return -1;
+    // Like gr_text(), drop whatever runs off the screen.
+    fit = (screen_width() - overscan_offset_x - x) / font->cwidth;
+    if (maxlen > fit)
+        maxlen = fit;
+    cmd = dl_append(dl, GR_DL_TEXT, x, y, maxlen * font->cwidth, font->cheight);
+    if (cmd == NULL)
+        return -1;
+    cmd->text = text;
+    cmd->count = maxlen;
+    cmd->bold = bold && (font->texture->height != font->cheight);
+    return 0;
+}
+
+// Clip a recorded box against the clip rect, which is kept in gr_fb
+// coordinates.
+static bool dl_clip(const GRDrawCmd* cmd, int* x, int* y, int* w, int* h, int* sx, int* sy) {
+    GRRect r = { cmd->x, cmd->y, cmd->w, cmd->h };
+    GRRect clip;
+
+    *x = cmd->x;
+    *y = cmd->y;
+    *w = cmd->w;
+    *h = cmd->h;
+    *sx = cmd->sx;
+    *sy = cmd->sy;
+    if (!gr_clipping)
+        return true;
+    clip = gr_clip_rect;
+    clip.x += overscan_offset_x;
+    clip.y += overscan_offset_y;
+    if (!rect_intersect(&r, &clip))
+        return false;
+    *sx += r.x - cmd->x;
+    *sy += r.y - cmd->y;
+    *x = r.x;
+    *y = r.y;
+    *w = r.w;
+    *h = r.h;
+    return true;
+}
+
+static void dl_text(const GRDrawCmd* cmd) {
+    GRFont* font = gr_font;
+    const char* s = cmd->text;
+    GRDrawCmd glyph = *cmd;
+    unsigned off;
+    int i, x, y, w, h, sx, sy;
+
+    if (gr_current_a == 0)
+        return;
+    glyph.w = font->cwidth;
+    for (i = 0; i < cmd->count && (off = (unsigned char)s[i]); i++) {
+        off -= 32;
+        glyph.x = cmd->x + i * font->cwidth;
+        if (off >= 96 || !dl_clip(&glyph, &x, &y, &w, &h, &sx, &sy))
+            continue;
+        text_blend(font->texture->data + off * font->cwidth + sx +
+                   (sy + (cmd->bold ? font->cheight : 0)) * font->texture->row_bytes,
+                   font->texture->row_bytes, x, y, w, h);
+    }
+}
+
+void gr_dl_replay(const GRDisplayList* dl, const int* vars) {
+    int i, x, y, w, h, sx, sy;
+
+    if (dl->width != screen_width() || dl->height != screen_height()) {
+        LOGE("display list recorded for %dx%d, screen is %dx%d\n",
+             dl->width, dl->height, screen_width(), screen_height());
+        return;
+    }
+    for (i = 0; i < dl->n; i++) {
+        const GRDrawCmd* cmd = &dl->cmds[i];
+        GRSurface* source;
+
+        switch (cmd->op) {
+        case GR_DL_COLOR:
+            gr_color(cmd->rgba[0], cmd->rgba[1], cmd->rgba[2], cmd->rgba[3]);
+            break;
+        case GR_DL_FILL:
+            if (dl_clip(cmd, &x, &y, &w, &h, &sx, &sy))
+                fill_rect(x, y, x + w, y + h);
+            break;
+        case GR_DL_BLIT:
+            source = cmd->surface;
+            if (cmd->var >= 0) {
+                int v = vars[cmd->var];
+                if (v < 0 || v >= cmd->count)
+                    break;
+                source = cmd->table[v];
+            }
+            if (dl_clip(cmd, &x, &y, &w, &h, &sx, &sy))
+                blit_rect(source, sx, sy, w, h, x, y);
+            break;
+        case GR_DL_BLEND:
+            if (dl_clip(cmd, &x, &y, &w, &h, &sx, &sy))
+                blend_rect(cmd->surface, sx, sy, w, h, x, y);
+            break;
+        case GR_DL_TEXT:
+            dl_text(cmd);
+            break;
+        }
+    }
+}
+
 static void gr_init_font(void) {
     gr_font = calloc(sizeof(*gr_font), 1);
 
@@ -353,31 +890,247 @@ void gr_sync(void) {
     if (gr_backend->sync)
         gr_backend->sync(gr_draw);
 }
+void gr_damage(int x, int y, int w, int h) {
+    GRRect r = { x, y, w, h };
+    GRRect screen = { 0, 0, gr_fb_width(), gr_fb_height() };
+
+    if (rect_intersect(&r, &screen))
+        damage_add(&gr_frame_damage, &r);
+}
+
+void gr_damage_all(void) {
+    gr_frame_damage.all = true;
+}
+
+int gr_damage_region(GRRect *rects, int max) {
+    GRDamage d = gr_frame_damage;
+    bool found = false;
+    int i;
+
+    // Walk back to the last frame drawn into this buffer; everything
+    // damaged since then is missing from it.
+    for (i = gr_history_len - 1; i >= 0 && !d.all; i--) {
+        if (gr_history[i].surface == gr_draw) {
+            found = true;
+            break;
+        }
+        damage_merge(&d, &gr_history[i].damage);
+    }
+    // A frame turned over in gr_flip() never matches what was drawn.
+    if (!found || rotation != draw_rotation())
+        d.all = true;
+
+    if (max < 1)
+        return 0;
+    if (d.all) {
+        rects[0].x = 0;
+        rects[0].y = 0;
+        rects[0].w = gr_fb_width();
+        rects[0].h = gr_fb_height();
+        return 1;
+    }
+    if (d.n > max) {
+        rects[0] = d.r[0];
+        for (i = 1; i < d.n; i++)
+            rect_union(&rects[0], &d.r[i]);
+        return 1;
+    }
+    memcpy(rects, d.r, d.n * sizeof(*rects));
+    return d.n;
+}
+
+void gr_clip(const GRRect *clip) {
+    gr_clipping = clip != NULL;
+    if (clip)
+        gr_clip_rect = *clip;
+}
+
+// Remember what this frame changed in the buffer it was drawn into.
+static void gr_damage_commit(void) {
+    if (gr_history_len == GR_DAMAGE_HISTORY) {
+        memmove(gr_history, gr_history + 1, sizeof(gr_history[0]) * (GR_DAMAGE_HISTORY - 1));
+        gr_history_len--;
+    }
+    gr_history[gr_history_len].surface = gr_draw;
+    gr_history[gr_history_len].damage = gr_frame_damage;
+    gr_history_len++;
+    memset(&gr_frame_damage, 0, sizeof(gr_frame_damage));
+}
+
+static long long gr_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The vsync nearest to 'when', at least one refresh after 'vsync'.
+static long long gr_anim_snap(long long when, long long vsync) {
+    long long n = (when - vsync + gr_refresh_ns / 2) / gr_refresh_ns;
+    return vsync + (n > 0 ? n : 1) * gr_refresh_ns;
+}
+
+// Account for a frame that reached the screen at 'vsync'.
+static void gr_anim_flip_done(long long vsync) {
+    gr_anim_frames++;
+    if (gr_anim_period_ns <= 0)
+        return;
+
+    if (gr_anim_ideal_ns == 0 || vsync < gr_anim_ideal_ns - gr_anim_period_ns) {
+        // First frame, or one drawn off schedule: start over from here.
+        gr_anim_ideal_ns = vsync + gr_anim_period_ns;
+    } else {
+        if (vsync > gr_anim_target_ns + gr_refresh_ns / 2)
+            gr_anim_late++;
+        gr_anim_ideal_ns += gr_anim_period_ns;
+        while (gr_anim_ideal_ns <= vsync) {
+            gr_anim_ideal_ns += gr_anim_period_ns;
+            gr_anim_dropped++;
+        }
+    }
+    gr_anim_target_ns = gr_anim_snap(gr_anim_ideal_ns, vsync);
+}
+
+// Pick up flips the backend completed since the last call; a new
+// vsync timestamp means one more.  A synchronous flip from a backend
+// that has no timestamps is stamped with the current time.
+static void gr_anim_poll(bool sync) {
+    static long long seen = 0;
+    long long vsync = 0, refresh = 0;
+
+    if (gr_backend->timing)
+        gr_backend->timing(gr_backend, &vsync, &refresh);
+    if (refresh > 0)
+        gr_refresh_ns = refresh;
+    if (vsync > 0) {
+        if (vsync == seen)
+            return;
+        seen = vsync;
+    } else if (sync) {
+        vsync = gr_now_ns();
+    } else {
+        return;
+    }
+    gr_anim_flip_done(vsync);
+}
+
+void gr_anim_set_period(int period_ms) {
+    gr_anim_period_ns = period_ms * 1000000LL;
+    gr_anim_reset();
+}
+
+void gr_anim_reset(void) {
+    gr_anim_ideal_ns = 0;
+    gr_anim_target_ns = 0;
+    gr_anim_flipped = false;
+}
+
+int gr_anim_next_ms(void) {
+    long long now = gr_now_ns();
+
+    if (gr_anim_period_ns <= 0)
+        return -1;
+    if (gr_anim_ideal_ns == 0)
+        return 0;
+    // Nothing was flipped for the last slot, so the scene didn't
+    // change; move on to the next slot without calling it a drop.
+    if (!gr_anim_flipped) {
+        while (gr_anim_target_ns - gr_refresh_ns <= now) {
+            gr_anim_ideal_ns += gr_anim_period_ns;
+            gr_anim_target_ns = gr_anim_snap(gr_anim_ideal_ns, gr_anim_target_ns - gr_refresh_ns);
+        }
+    }
+    gr_anim_flipped = false;
+
+    // Wake just after the vsync before the target, so the flip is
+    // submitted in time to land on the target itself.
+    now = gr_anim_target_ns - gr_refresh_ns - now;
+    return now > 0 ? (int)((now + 999999) / 1000000) : 0;
+}
+
+void gr_anim_stats(unsigned int* frames, unsigned int* late, unsigned int* dropped) {
+    *frames = gr_anim_frames;
+    *late = gr_anim_late;
+    *dropped = gr_anim_dropped;
+}
+
 extern int adf_blank_done;
 extern int flip_enter;
-void gr_flip() {
+static bool gr_flip_submit(bool async) {
+       static int logged_blank = -1;
+       bool queued = false;
        flip_enter = 1;
-       LOGE("adf_blank_status = %d (1: splash screen 0: not splash screen)\n",adf_blank_done);
+       gr_damage_commit();
+       if (adf_blank_done != logged_blank) {
+              LOGE("adf_blank_status = %d (1: splash screen 0: not splash screen)\n",adf_blank_done);
+              logged_blank = adf_blank_done;
+       }
        if (!adf_blank_done){
                 flip_enter = 0;
-		return;
+		return false;
        }
 /* SPRD: add for support rotate @{ */
 	switch(rotation){
 		case FB_ROTATE_UD:
-			gr_rotate_180();
+			if (gr_rotate_on_flip)
+				gr_rotate_180();
 			break;
 		default:
 			;
 		}
 /* @} */
-      gr_draw = gr_backend->flip(gr_backend);
+      gr_anim_flipped = true;
+      gr_unblank_flip = false;
+      if (async && gr_backend->flip_async) {
+          gr_draw = gr_backend->flip_async(gr_backend);
+          if (gr_backend->wait_flips)
+              queued = gr_backend->wait_flips(gr_backend, 0);
+          gr_anim_poll(false);
+      } else {
+          gr_draw = gr_backend->flip(gr_backend);
+          gr_anim_poll(true);
+      }
       flip_enter = 0;
+      return queued;
+}
+
+void gr_flip() {
+    gr_flip_submit(false);
+}
+
+bool gr_flip_async(void) {
+    return gr_flip_submit(true);
+}
+
+int gr_flip_fd(void) {
+    if (gr_backend->flip_fd == NULL)
+        return -1;
+    return gr_backend->flip_fd(gr_backend);
+}
+
+bool gr_flip_events(void) {
+    bool queued = false;
+
+    if (gr_backend->wait_flips)
+        queued = gr_backend->wait_flips(gr_backend, 0);
+    gr_anim_poll(false);
+    return queued;
+}
+
+void gr_flip_on_unblank(void) {
+    gr_unblank_flip = true;
+}
+
+void gr_wait_idle(void) {
+    if (gr_backend->wait_flips)
+        gr_backend->wait_flips(gr_backend, -1);
+    gr_anim_poll(false);
 }
 
 int gr_init(void) {
+    char value[PROPERTY_VALUE_MAX];
+
 /* SPRD: add for support rotate @{ */
-/*	char rotate_str[PROPERTY_VALUE_MAX+1];
+	char rotate_str[PROPERTY_VALUE_MAX+1];
 	property_get("ro.sf.hwrotation", rotate_str, "0");
 	printf("in %s: ro.sf.hwrotation=%s\n",__func__,rotate_str);
 	if (!strcmp(rotate_str, "90")) {
@@ -386,11 +1139,16 @@ int gr_init(void) {
 		rotation = FB_ROTATE_UD;
 	} else if (!strcmp(rotate_str, "270")) {
 		rotation = FB_ROTATE_CCW;
-}*/
+	}
 /* @} */
 	
     gr_init_font();
+    raster_init();
+    property_get("vendor.charge.rotate_on_flip", value, "0");
+    gr_rotate_on_flip = !strcmp(value, "1");
+    printf("minui: %s raster kernels\n", raster->name);
 
+#ifndef MINUI_NO_VT    // host tools leave the console alone
     gr_vt_fd = open("/dev/tty0", O_RDWR | O_SYNC);
     if (gr_vt_fd < 0) {
         // This is non-fatal; post-Cupcake kernels don't have tty0.
@@ -401,12 +1159,25 @@ int gr_init(void) {
         gr_exit();
         return -1;
     }
+#endif
 
-    gr_backend = open_adf();
+#ifdef MINUI_MEM_BACKEND    // only builds that ask for it look it up
+    gr_backend = open_mem();
     if (gr_backend) {
         gr_draw = gr_backend->init(gr_backend);
-        if (!gr_draw) {
-            gr_backend->exit(gr_backend);
+        if (gr_draw == NULL) {
+            return -1;
+        }
+    }
+#endif
+
+    if (!gr_draw) {
+        gr_backend = open_adf();
+        if (gr_backend) {
+            gr_draw = gr_backend->init(gr_backend);
+            if (!gr_draw) {
+                gr_backend->exit(gr_backend);
+            }
         }
     }
 
@@ -426,8 +1197,8 @@ int gr_init(void) {
         }
     }
 
-    overscan_offset_x = gr_draw->width * overscan_percent / 100;
-    overscan_offset_y = gr_draw->height * overscan_percent / 100;
+    overscan_offset_x = screen_width() * overscan_percent / 100;
+    overscan_offset_y = screen_height() * overscan_percent / 100;
 
     gr_flip();
     gr_flip();
@@ -436,60 +1207,52 @@ int gr_init(void) {
 }
 
 void gr_exit(void) {
+    gr_wait_idle();
     gr_backend->exit(gr_backend);
 
-    ioctl(gr_vt_fd, KDSETMODE, (void*) KD_TEXT);
-    close(gr_vt_fd);
+    if (gr_vt_fd >= 0) {
+        ioctl(gr_vt_fd, KDSETMODE, (void*) KD_TEXT);
+        close(gr_vt_fd);
+    }
     gr_vt_fd = -1;
 }
 
 int gr_fb_width(void) {
-    return gr_draw->width - 2*overscan_offset_x;
+    return screen_width() - 2*overscan_offset_x;
 }
 
 int gr_fb_height(void) {
-    return gr_draw->height - 2*overscan_offset_y;
+    return screen_height() - 2*overscan_offset_y;
 }
 
-void gr_fb_blank(bool blank) {
+bool gr_fb_blank(bool blank) {
+    bool queued = false;
+    long long start;
+
+    gr_wait_idle();
+    start = gr_now_ns();
     gr_backend->blank(gr_backend, blank);
+    gr_anim_reset();
+    if (!blank && gr_unblank_flip)
+        queued = gr_flip_async();
+    LOGD("%s took %lld us\n", blank ? "blank" : "unblank", (gr_now_ns() - start) / 1000);
+    return queued;
 }
 
 /* SPRD: add for support rotate @{ */
+// Turn gr_draw over in place: swap each row with its mirror row,
+// reversing both, and reverse the middle row of an odd height.
 static void gr_rotate_180()
 {
 	int height = gr_draw->height;
 	int width = gr_draw->width;
-	int row_bytes = gr_draw->row_bytes;
-	unsigned char* src_p = gr_draw->data;
-	unsigned char* dst_p ;
-	unsigned char* src_p_b;
-	int i, j;
-	dst_p = malloc(row_bytes*height);
-	if(!dst_p){
-		return;
-	}
-	src_p_b = dst_p + row_bytes*height -1;
-	for (j = 0; j < height; ++j) {
-	    unsigned char* sx = src_p;
-	    unsigned char* px = src_p_b ;
-	    for (i = 0; i < width; ++i) {
-		*(px-0) = *(sx+3);
-		*(px-1) = *(sx+2);
-		*(px-2) = *(sx+1);
-		*(px-3) = *(sx+0);
-		px-=4;
-		sx+=4;
-	    }
-	    src_p += row_bytes;
-	    src_p_b -= row_bytes;
-	}
-	memcpy(gr_draw->data,dst_p,row_bytes*height);
-	
-	if(dst_p){
-		free(dst_p);
-		dst_p = 0;
-	}
+	int j;
+
+	for (j = 0; j < height / 2; ++j)
+		raster->swap_reverse(pixel_at(0, j), pixel_at(0, height - 1 - j), width);
+	if (height & 1)
+		raster->swap_reverse(pixel_at(0, height / 2),
+				     pixel_at(width - width / 2, height / 2), width / 2);
 }
 /* @} */
 
@@ -39,11 +39,32 @@ typedef struct minui_backend {
 
     // Device cleanup when drawing is done.
     void (*exit)(struct minui_backend*);
+
+    // Optional.  When the last flip() reached the screen, in
+    // CLOCK_MONOTONIC nanoseconds, and the refresh period in
+    // nanoseconds.  Leave either at 0 if the device doesn't know.
+    void (*timing)(struct minui_backend*, long long* vsync_ns, long long* refresh_ns);
+
+    // Optional asynchronous flipping.  flip_async() queues the current
+    // drawing surface and returns a new one without waiting for it to
+    // be displayed.  flip_fd() becomes readable when a queued flip
+    // completes, and wait_flips() handles that, waiting up to
+    // timeout_ms (as for poll()); it returns true while a flip is
+    // still queued.
+    gr_surface (*flip_async)(struct minui_backend*);
+    int (*flip_fd)(struct minui_backend*);
+    bool (*wait_flips)(struct minui_backend*, int timeout_ms);
 } minui_backend;
 
 minui_backend* open_fbdev();
 minui_backend* open_adf();
 minui_backend* open_drm();
+// Headless; NULL unless selected (see graphics_mem.c).
+minui_backend* open_mem();
+
+// Up to 'max' of the latest flip times of the headless backend,
+// oldest first, in CLOCK_MONOTONIC nanoseconds.  Returns the count.
+int mem_flip_times(long long* times, int max);
 
 #ifdef __cplusplus
 }
@@ -47,6 +47,7 @@ struct adf_pdata {
     unsigned int current_surface;
     unsigned int n_surfaces;
     struct adf_surface_pdata surfaces[2];
+    long long refresh_ns;
 };
 
 static gr_surface adf_flip(struct minui_backend *backend);
@@ -86,6 +87,9 @@ static int adf_interface_init(struct adf_pdata *pdata) {
     if (err < 0)
         return err;
 
+    if (intf_data.current_mode.vrefresh)
+        pdata->refresh_ns = 1000000000LL / intf_data.current_mode.vrefresh;
+
     err = adf_surface_init(pdata, &intf_data.current_mode, &pdata->surfaces[0]);
     if (err < 0) {
         fprintf(stderr, "allocating surface 0 failed: %s\n", strerror(-err));
@@ -231,6 +235,13 @@ static void adf_blank(struct minui_backend *backend, bool blank) {
             blank ? DRM_MODE_DPMS_OFF : DRM_MODE_DPMS_ON);
 }
 
+// Posts only hand back a fence, so the flip time is left to the caller.
+static void adf_timing(struct minui_backend *backend, long long *vsync_ns __unused,
+        long long *refresh_ns) {
+    struct adf_pdata *pdata = (struct adf_pdata *)backend;
+    *refresh_ns = pdata->refresh_ns;
+}
+
 static void adf_surface_destroy(struct adf_surface_pdata *surf) {
     munmap(surf->base.data, surf->pitch * surf->base.height);
     close(surf->fence_fd);
@@ -260,5 +271,6 @@ minui_backend *open_adf() {
     pdata->base.flip = adf_flip;
     pdata->base.blank = adf_blank;
     pdata->base.exit = adf_exit;
+    pdata->base.timing = adf_timing;
     return &pdata->base;
 }
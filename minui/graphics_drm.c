@@ -43,13 +43,23 @@ struct drm_surface_pdata {
 
 typedef struct drm_surface_pdata* gr_surface_drm;
 
+// Three buffers let the next frame be drawn while the last one is
+// still waiting for its flip; with only two, flips wait for vblank.
+#define DRM_BUFFERS 3
+
 struct drm_pdata {
     minui_backend base;
-    struct drm_surface_pdata* GRSurfaceDrms[2];
-    int current_buffer;
+    struct drm_surface_pdata* GRSurfaceDrms[DRM_BUFFERS];
+    int n_buffers;
+    int current_buffer;     // being drawn
+    int front_buffer;       // being scanned out
+    int pending_buffer;     // queued for the next vblank, -1 if none
     drmModeCrtc* main_monitor_crtc;
     drmModeConnector* main_monitor_connector;
     int drm_fd;
+    long long vsync_ns;
+    uint32_t dpms_prop;     // connector DPMS property, 0 if none
+    bool crtc_off;          // blanked by disabling the CRTC
 };
 
 static void DrmDisableCrtc(int drm_fd, drmModeCrtc* crtc) {
@@ -75,14 +85,45 @@ static void DrmEnableCrtc(struct drm_pdata* pdata,
   }
 }
 
+// Id of the connector's DPMS property, or 0.
+static uint32_t find_dpms_prop(int fd, uint32_t connector_id) {
+  drmModeObjectProperties* props;
+  uint32_t id = 0;
+
+  props = drmModeObjectGetProperties(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR);
+  if (!props) return 0;
+  for (uint32_t i = 0; i < props->count_props && !id; i++) {
+    drmModePropertyRes* prop = drmModeGetProperty(fd, props->props[i]);
+    if (!prop) continue;
+    if (!strcmp(prop->name, "DPMS")) id = prop->prop_id;
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return id;
+}
+
+// Blank through the connector's DPMS property where there is one, which
+// keeps the mode and the scanned out buffer, so waking up doesn't need a
+// modeset.  Otherwise fall back to turning the CRTC off and on.
 static void drm_blank(struct minui_backend *backend, bool blank) {
   struct drm_pdata *pdata = (struct drm_pdata *)backend;
 
+  if (pdata->dpms_prop && !(!blank && pdata->crtc_off)) {
+    int ret = drmModeConnectorSetProperty(pdata->drm_fd,
+                                          pdata->main_monitor_connector->connector_id,
+                                          pdata->dpms_prop,
+                                          blank ? DRM_MODE_DPMS_OFF : DRM_MODE_DPMS_ON);
+    if (ret == 0) return;
+    printf("drm: DPMS %s failed ret=%d, using modeset\n", blank ? "off" : "on", ret);
+  }
+
   if (blank) {
     DrmDisableCrtc(pdata->drm_fd, pdata->main_monitor_crtc);
+    pdata->crtc_off = true;
   } else {
     DrmEnableCrtc(pdata, pdata->main_monitor_crtc,
-                  pdata->GRSurfaceDrms[pdata->current_buffer]);
+                  pdata->GRSurfaceDrms[pdata->front_buffer]);
+    pdata->crtc_off = false;
   }
 }
 
@@ -402,8 +443,20 @@ static gr_surface drm_init(struct minui_backend *backend) {
     // GRSurfaceDrms and drm_fd should be freed in d'tor.
     return NULL;
   }
+  pdata->n_buffers = 2;
+  for (int i = 2; i < DRM_BUFFERS; i++) {
+    pdata->GRSurfaceDrms[i] = DrmCreateSurface(pdata->drm_fd, width, height);
+    if (!pdata->GRSurfaceDrms[i]) break;
+    pdata->n_buffers++;
+  }
+  pdata->dpms_prop = find_dpms_prop(pdata->drm_fd,
+                                    pdata->main_monitor_connector->connector_id);
+  printf("drm: %d buffers, blank with %s\n", pdata->n_buffers,
+         pdata->dpms_prop ? "DPMS" : "modeset");
 
   pdata->current_buffer = 0;
+  pdata->front_buffer = 1;
+  pdata->pending_buffer = -1;
 
   DrmEnableCrtc(pdata, pdata->main_monitor_crtc,
                 pdata->GRSurfaceDrms[1]);
@@ -413,31 +466,31 @@ static gr_surface drm_init(struct minui_backend *backend) {
 
 static void page_flip_complete(__unused int fd,
                                __unused unsigned int sequence,
-                               __unused unsigned int tv_sec,
-                               __unused unsigned int tv_usec,
+                               unsigned int tv_sec,
+                               unsigned int tv_usec,
                                void *user_data) {
-  *(bool *)user_data = false;
+  struct drm_pdata *pdata = (struct drm_pdata *)user_data;
+
+  // DRM stamps events with CLOCK_MONOTONIC.
+  pdata->vsync_ns = tv_sec * 1000000000LL + tv_usec * 1000LL;
+  pdata->front_buffer = pdata->pending_buffer;
+  pdata->pending_buffer = -1;
 }
 
-static gr_surface drm_flip(struct minui_backend *backend) {
+// Handle the completion of the queued flip, waiting up to timeout_ms
+// for it (as for poll()).  Returns true while it is still queued.
+static bool drm_wait_flips(struct minui_backend *backend, int timeout_ms) {
   struct drm_pdata *pdata = (struct drm_pdata *)backend;
-  bool ongoing_flip = true;
-
-  int ret = drmModePageFlip(pdata->drm_fd, pdata->main_monitor_crtc->crtc_id,
-                            pdata->GRSurfaceDrms[pdata->current_buffer]->fb_id,
-                            DRM_MODE_PAGE_FLIP_EVENT, &ongoing_flip);
-  if (ret < 0) {
-    printf("drmModePageFlip failed ret=%d\n", ret);
-    return NULL;
-  }
 
-  while (ongoing_flip) {
+  while (pdata->pending_buffer >= 0) {
     struct pollfd fds = {
       .fd = pdata->drm_fd,
       .events = POLLIN
     };
 
-    ret = poll(&fds, 1, -1);
+    int ret = poll(&fds, 1, timeout_ms);
+    if (ret == 0) break;
+    if (ret == -1 && errno == EINTR) continue;
     if (ret == -1 || !(fds.revents & POLLIN)) {
       printf("poll() failed on drm fd\n");
       break;
@@ -454,16 +507,74 @@ static gr_surface drm_flip(struct minui_backend *backend) {
       break;
     }
   }
+  return pdata->pending_buffer >= 0;
+}
+
+static int drm_flip_fd(struct minui_backend *backend) {
+  return ((struct drm_pdata *)backend)->drm_fd;
+}
+
+// A buffer that is neither on screen nor queued, or -1.
+static int drm_free_buffer(struct drm_pdata *pdata) {
+  for (int i = 0; i < pdata->n_buffers; i++) {
+    if (i != pdata->front_buffer && i != pdata->pending_buffer) return i;
+  }
+  return -1;
+}
+
+// Queue the current buffer and hand back a free one without waiting for
+// vblank, unless the previous flip is still queued (a CRTC takes one at
+// a time) or there is no third buffer to draw into meanwhile.
+static gr_surface drm_flip_async(struct minui_backend *backend) {
+  struct drm_pdata *pdata = (struct drm_pdata *)backend;
+  int next;
+
+  drm_wait_flips(backend, -1);
+
+  int ret = drmModePageFlip(pdata->drm_fd, pdata->main_monitor_crtc->crtc_id,
+                            pdata->GRSurfaceDrms[pdata->current_buffer]->fb_id,
+                            DRM_MODE_PAGE_FLIP_EVENT, pdata);
+  if (ret < 0) {
+    printf("drmModePageFlip failed ret=%d\n", ret);
+    return pdata->GRSurfaceDrms[pdata->current_buffer];
+  }
+  pdata->pending_buffer = pdata->current_buffer;
+
+  next = drm_free_buffer(pdata);
+  if (next < 0) {
+    drm_wait_flips(backend, -1);
+    next = drm_free_buffer(pdata);
+  }
+  if (next < 0) next = pdata->pending_buffer;  // flip lost; keep drawing there
+  pdata->current_buffer = next;
+  return pdata->GRSurfaceDrms[next];
+}
+
+static gr_surface drm_flip(struct minui_backend *backend) {
+  gr_surface draw = drm_flip_async(backend);
+
+  drm_wait_flips(backend, -1);
+  return draw;
+}
+
+static void drm_timing(struct minui_backend *backend, long long *vsync_ns,
+                       long long *refresh_ns) {
+  struct drm_pdata *pdata = (struct drm_pdata *)backend;
+  drmModeModeInfo *mode = &pdata->main_monitor_crtc->mode;
 
-  pdata->current_buffer = 1 - pdata->current_buffer;
-  return pdata->GRSurfaceDrms[pdata->current_buffer];
+  *vsync_ns = pdata->vsync_ns;
+  if (mode->clock && mode->htotal && mode->vtotal)
+    *refresh_ns = (long long)mode->htotal * mode->vtotal * 1000000LL / mode->clock;
+  else if (mode->vrefresh)
+    *refresh_ns = 1000000000LL / mode->vrefresh;
 }
 
 static void drm_exit(struct minui_backend *backend) {
     struct drm_pdata *pdata = (struct drm_pdata *)backend;
     unsigned int i;
 
-    for (i = 0; i < 2; i++)
+    drm_wait_flips(backend, -1);
+    for (i = 0; i < DRM_BUFFERS; i++)
         DrmDestroySurface(pdata->drm_fd, pdata->GRSurfaceDrms[i]);
     if (pdata->drm_fd >= 0)
         close(pdata->drm_fd);
@@ -480,10 +591,15 @@ minui_backend *open_drm() {
     pdata->main_monitor_crtc = NULL;
     pdata->main_monitor_connector = NULL;
     pdata->drm_fd = -1;
+    pdata->pending_buffer = -1;
 
     pdata->base.init = drm_init;
     pdata->base.flip = drm_flip;
     pdata->base.blank = drm_blank;
     pdata->base.exit = drm_exit;
+    pdata->base.timing = drm_timing;
+    pdata->base.flip_async = drm_flip_async;
+    pdata->base.flip_fd = drm_flip_fd;
+    pdata->base.wait_flips = drm_wait_flips;
     return &pdata->base;
 }
@@ -37,6 +37,7 @@ static gr_surface fbdev_init(minui_backend*);
 static gr_surface fbdev_flip(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
+static void fbdev_timing(minui_backend*, long long*, long long*);
 
 static GRSurface gr_framebuffer[2];
 static bool double_buffered;
@@ -51,6 +52,7 @@ static minui_backend my_backend = {
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .timing = fbdev_timing,
 };
 
 minui_backend* open_fbdev() {
@@ -205,6 +207,17 @@ static gr_surface fbdev_flip(minui_backend* backend __unused) {
     return gr_draw;
 }
 
+// The refresh period follows from the video mode; pixclock is in
+// picoseconds per pixel.
+static void fbdev_timing(minui_backend* backend __unused, long long* vsync_ns __unused,
+                         long long* refresh_ns) {
+    long long htotal = vi.xres + vi.left_margin + vi.right_margin + vi.hsync_len;
+    long long vtotal = vi.yres + vi.upper_margin + vi.lower_margin + vi.vsync_len;
+
+    if (vi.pixclock)
+        *refresh_ns = htotal * vtotal * vi.pixclock / 1000;
+}
+
 static void fbdev_exit(minui_backend* backend __unused) {
     close(fb_fd);
     fb_fd = -1;
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Headless backend: two buffers in RAM and no display.  Selected with
+// MINUI_BACKEND=mem in the environment or vendor.charge.minui_backend=mem,
+// so the drawing code can be run and timed off-device.  gr_init() only
+// looks for it when built with MINUI_MEM_BACKEND (host tools, or
+// CHARGE_MINUI_MEM_BACKEND=true for a device build), so a normal boot
+// goes straight to the display.
+//
+//   MINUI_MEM_SIZE  WxH of the screen, 720x1280 by default
+//   MINUI_MEM_HZ    refresh rate reported to the animation clock, 60
+//   MINUI_MEM_DUMP  directory to write every flipped frame to, as
+//                   frame_NNNNN.ppm
+//
+// Each can also be set as the property vendor.charge.minui_mem_size,
+// _hz or _dump; the environment wins.  Flips never wait, so frame times
+// measure drawing alone.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/cdefs.h>
+
+#include "minui.h"
+#include "graphics.h"
+#include "cutils/properties.h"
+
+#define MEM_WIDTH 720
+#define MEM_HEIGHT 1280
+#define MEM_HZ 60
+#define MEM_FLIP_LOG 1024
+
+static gr_surface mem_init(minui_backend*);
+static gr_surface mem_flip(minui_backend*);
+static void mem_blank(minui_backend*, bool);
+static void mem_exit(minui_backend*);
+static void mem_timing(minui_backend*, long long*, long long*);
+
+static GRSurface gr_framebuffer[2];
+static int displayed_buffer;
+static long long refresh_ns;
+static char dump_dir[PROPERTY_VALUE_MAX];
+static unsigned int frames_flipped;
+
+// CLOCK_MONOTONIC time of the last MEM_FLIP_LOG flips, oldest first
+// once the log has wrapped.
+static long long flip_log[MEM_FLIP_LOG];
+
+static minui_backend my_backend = {
+    .init = mem_init,
+    .flip = mem_flip,
+    .blank = mem_blank,
+    .exit = mem_exit,
+    .timing = mem_timing,
+};
+
+static void mem_config(const char* env, const char* prop, char* value,
+                       const char* default_value) {
+    const char* s = getenv(env);
+
+    if (s) {
+        strncpy(value, s, PROPERTY_VALUE_MAX - 1);
+        value[PROPERTY_VALUE_MAX - 1] = '\0';
+    } else {
+        property_get(prop, value, default_value);
+    }
+}
+
+minui_backend* open_mem() {
+    char value[PROPERTY_VALUE_MAX];
+
+    mem_config("MINUI_BACKEND", "vendor.charge.minui_backend", value, "");
+    if (strcmp(value, "mem"))
+        return NULL;
+    return &my_backend;
+}
+
+static long long mem_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static gr_surface mem_init(minui_backend* backend __unused) {
+    char value[PROPERTY_VALUE_MAX];
+    int width, height, hz, i;
+
+    mem_config("MINUI_MEM_SIZE", "vendor.charge.minui_mem_size", value, "");
+    if (sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+        width = MEM_WIDTH;
+        height = MEM_HEIGHT;
+    }
+    mem_config("MINUI_MEM_HZ", "vendor.charge.minui_mem_hz", value, "");
+    hz = atoi(value);
+    refresh_ns = 1000000000LL / (hz > 0 ? hz : MEM_HZ);
+    mem_config("MINUI_MEM_DUMP", "vendor.charge.minui_mem_dump", dump_dir, "");
+
+    for (i = 0; i < 2; i++) {
+        gr_framebuffer[i].width = width;
+        gr_framebuffer[i].height = height;
+        gr_framebuffer[i].pixel_bytes = 4;
+        gr_framebuffer[i].row_bytes = width * 4;
+        gr_framebuffer[i].data = calloc(height, width * 4);
+        if (!gr_framebuffer[i].data) {
+            perror("failed to allocate in-memory framebuffer");
+            return NULL;
+        }
+    }
+    frames_flipped = 0;
+    displayed_buffer = 0;
+
+    printf("mem: %dx%d, %lld ns refresh%s%s\n", width, height, refresh_ns,
+           dump_dir[0] ? ", frames to " : "", dump_dir);
+    return &gr_framebuffer[1];
+}
+
+// Write 'surface' as a binary PPM.  Pixels are stored R, G, B, X.
+static void mem_dump(const GRSurface* surface, unsigned int frame) {
+    char path[PROPERTY_VALUE_MAX + 32];
+    unsigned char* row;
+    FILE* fp;
+    int x, y;
+
+    snprintf(path, sizeof(path), "%s/frame_%05u.ppm", dump_dir, frame);
+    fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        dump_dir[0] = '\0';     // don't fail once per frame
+        return;
+    }
+    row = malloc(surface->width * 3);
+    if (row) {
+        fprintf(fp, "P6\n%d %d\n255\n", surface->width, surface->height);
+        for (y = 0; y < surface->height; y++) {
+            const unsigned char* px = surface->data + y * surface->row_bytes;
+            for (x = 0; x < surface->width; x++, px += 4) {
+                row[x * 3] = px[0];
+                row[x * 3 + 1] = px[1];
+                row[x * 3 + 2] = px[2];
+            }
+            fwrite(row, 3, surface->width, fp);
+        }
+        free(row);
+    }
+    fclose(fp);
+}
+
+static gr_surface mem_flip(minui_backend* backend __unused) {
+    displayed_buffer = 1 - displayed_buffer;
+    flip_log[frames_flipped % MEM_FLIP_LOG] = mem_now_ns();
+    if (dump_dir[0])
+        mem_dump(&gr_framebuffer[displayed_buffer], frames_flipped);
+    frames_flipped++;
+    return &gr_framebuffer[1 - displayed_buffer];
+}
+
+static void mem_blank(minui_backend* backend __unused, bool blank __unused) {
+}
+
+static void mem_timing(minui_backend* backend __unused, long long* vsync_ns,
+                       long long* refresh) {
+    *vsync_ns = frames_flipped ? flip_log[(frames_flipped - 1) % MEM_FLIP_LOG] : 0;
+    *refresh = refresh_ns;
+}
+
+int mem_flip_times(long long* times, int max) {
+    unsigned int n = frames_flipped < MEM_FLIP_LOG ? frames_flipped : MEM_FLIP_LOG;
+    unsigned int first = frames_flipped - n;
+    unsigned int i;
+
+    if (max < 0)
+        max = 0;
+    if (n > (unsigned int)max) {
+        first += n - max;
+        n = max;
+    }
+    for (i = 0; i < n; i++)
+        times[i] = flip_log[(first + i) % MEM_FLIP_LOG];
+    return n;
+}
+
+static void mem_exit(minui_backend* backend __unused) {
+    free(gr_framebuffer[0].data);
+    free(gr_framebuffer[1].data);
+    gr_framebuffer[0].data = gr_framebuffer[1].data = NULL;
+}
@@ -25,16 +25,35 @@
 extern "C" {
 #endif
 
+// Where a row of an image with alpha needs blending.  Pixels before
+// 'start' and from 'end' on are fully transparent, and those in
+// [opaque_start, opaque_end) fully opaque.
+typedef struct {
+    int start;
+    int opaque_start;
+    int opaque_end;
+    int end;
+} GRSpan;
+
 typedef struct {
     int width;
     int height;
     int row_bytes;
     int pixel_bytes;
     unsigned char* data;
+    // One per row for display surfaces with alpha; NULL when opaque.
+    GRSpan* spans;
 } GRSurface;
 
 typedef GRSurface* gr_surface;
 
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} GRRect;
+
 int gr_init(void);
 void gr_exit(void);
 
@@ -43,7 +62,23 @@ int gr_fb_height(void);
 
 void gr_sync(void);
 void gr_flip(void);
-void gr_fb_blank(bool blank);
+// Returns true if unblanking flipped a frame left by
+// gr_flip_on_unblank() and it is still queued, as gr_flip_async() does.
+bool gr_fb_blank(bool blank);
+
+// Asynchronous flips.  gr_flip_async() queues the frame and switches to
+// a new buffer to draw into without waiting for vblank (on backends
+// that can't, it is gr_flip()).  It returns true if the frame is still
+// queued; then watch gr_flip_fd() and call gr_flip_events() when it is
+// readable, which returns true for as long as the flip stays queued.
+// gr_wait_idle() blocks until nothing is queued.
+bool gr_flip_async(void);
+int gr_flip_fd(void);
+bool gr_flip_events(void);
+void gr_wait_idle(void);
+// Leave the frame drawn so far in the current buffer for the next
+// gr_fb_blank(false) to flip, so a wake shows it without a draw first.
+void gr_flip_on_unblank(void);
 
 void gr_clear();  // clear entire surface to current color
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -54,9 +89,64 @@ int gr_measure(const char *s);
 void gr_font_size(int *x, int *y);
 
 void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy);
+// As gr_blit(), but composite the source over what is on the screen
+// using its (premultiplied) alpha.  Opaque sources are simply copied.
+void gr_blit_blend(gr_surface source, int sx, int sy, int w, int h, int dx, int dy);
 unsigned int gr_get_width(gr_surface surface);
 unsigned int gr_get_height(gr_surface surface);
 
+// Damage tracking.  Mark what changed in this frame with gr_damage()
+// (or gr_damage_all() after drawing the whole screen); gr_flip()
+// remembers it per buffer.  gr_damage_region() returns the part of the
+// current draw buffer that is stale: this frame's damage plus that of
+// every frame the buffer missed while the other one was displayed.
+// Redraw those rects with gr_clip() set and leave the rest alone.
+#define GR_DAMAGE_MAX 8
+void gr_damage(int x, int y, int w, int h);
+void gr_damage_all(void);
+int gr_damage_region(GRRect *rects, int max);
+// Restrict gr_fill(), gr_clear(), gr_blit(), gr_blit_blend() and
+// gr_text() to 'clip'; NULL turns clipping off.
+void gr_clip(const GRRect *clip);
+
+// Animation clock.  gr_flip() timestamps every frame with the time it
+// reached the screen (the page flip event on DRM, CLOCK_MONOTONIC
+// elsewhere).  With a period set, gr_anim_next_ms() returns how long to
+// wait before drawing the next frame so that it lands on the vsync
+// closest to its slot, without drifting; -1 if no period is set.
+// gr_anim_stats() counts frames shown, frames that missed their vsync
+// and animation slots skipped because drawing fell behind.
+void gr_anim_set_period(int period_ms);
+void gr_anim_reset(void);
+int gr_anim_next_ms(void);
+void gr_anim_stats(unsigned int* frames, unsigned int* late, unsigned int* dropped);
+
+// Display lists.  A list records fills, blits and text once, checking
+// each command against the screen and applying the overscan offset as
+// it is recorded; gr_dl_replay() then draws them straight into the
+// buffer, honouring only gr_clip().  Rebuild the list (gr_dl_reset()
+// and record again) whenever the layout or the resolution changes.
+//
+// gr_dl_blit_var() records a blit whose source is picked at replay time
+// as table[vars[var]]; all 'count' surfaces of the table must hold the
+// blitted box.  gr_dl_text() draws up to 'maxlen' characters of the
+// string 'text' points to when the list is replayed.
+typedef struct GRDisplayList GRDisplayList;
+GRDisplayList* gr_dl_create(int capacity);
+void gr_dl_free(GRDisplayList* dl);
+void gr_dl_reset(GRDisplayList* dl);
+int gr_dl_color(GRDisplayList* dl, unsigned char r, unsigned char g,
+                unsigned char b, unsigned char a);
+int gr_dl_fill(GRDisplayList* dl, int x1, int y1, int x2, int y2);
+int gr_dl_blit(GRDisplayList* dl, gr_surface source, int sx, int sy,
+               int w, int h, int dx, int dy);
+int gr_dl_blit_var(GRDisplayList* dl, gr_surface* table, int count, int var,
+                   int sx, int sy, int w, int h, int dx, int dy);
+int gr_dl_blit_blend(GRDisplayList* dl, gr_surface source, int sx, int sy,
+                     int w, int h, int dx, int dy);
+int gr_dl_text(GRDisplayList* dl, int x, int y, const char* text, int maxlen, int bold);
+void gr_dl_replay(const GRDisplayList* dl, const int* vars);
+
 // input event structure, include <linux/input.h> for the definition.
 // see http://www.mjmwired.net/kernel/Documentation/input/ for info.
 struct input_event;
@@ -67,6 +157,10 @@ typedef int (*ev_set_key_callback)(int code, int value, void *data);
 int ev_init(void);
 void ev_exit(void);
 int ev_get(struct input_event *ev, int wait_ms);
+// Event loop access: the fd of device n (-1 past the last one), and
+// a read of one event from it with the same rules as ev_get().
+int ev_get_fd(unsigned n);
+int ev_read(unsigned n, struct input_event *ev);
 
 /* timeout has the same semantics as for poll
  *    0 : don't block
@@ -82,9 +176,11 @@ int ev_wait(int timeout);
 // negative.
 //
 // A "display" surface is one that is intended to be drawn to the
-// screen with gr_blit().  An "alpha" surface is a grayscale image
-// interpreted as an alpha mask used to render text in the current
-// color (with gr_text() or gr_texticon()).
+// screen with gr_blit() or gr_blit_blend().  RGBA images are stored
+// with premultiplied alpha, so gr_blit() draws them as if over black.
+// An "alpha" surface is a grayscale image interpreted as an alpha mask
+// used to render text in the current color (with gr_text() or
+// gr_texticon()).
 //
 // All these functions load PNG images from "/res/images/${name}.png".
 
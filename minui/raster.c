@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define RASTER_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RASTER_NEON 1
+#endif
+
+#include "raster.h"
+
+// Transposes work through TRANSPOSE_TILE x TRANSPOSE_TILE tiles, so
+// that the rows read and the rows written all stay in the cache.
+#define TRANSPOSE_TILE 16
+
+// The vector kernels blend in 16-bit lanes, where x / 255 for any
+// x <= 255 * 255 is exactly (x + 1 + (x >> 8)) >> 8.  The pad byte
+// gets alpha 0 (and colour 0), so it comes back unchanged.
+
+static uint32_t pattern(unsigned char r, unsigned char g, unsigned char b) {
+    unsigned char px[4] = { r, g, b, 0xff };
+    uint32_t v;
+    memcpy(&v, px, sizeof(v));
+    return v;
+}
+
+static void scalar_fill(unsigned char* px, int n,
+                        unsigned char r, unsigned char g, unsigned char b) {
+    while (n-- > 0) {
+        *px++ = r;
+        *px++ = g;
+        *px++ = b;
+        *px++ = 0xff;
+    }
+}
+
+static void scalar_blend(unsigned char* px, int n,
+                         unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+    while (n-- > 0) {
+        *px = (*px * (255-a) + r * a) / 255;
+        ++px;
+        *px = (*px * (255-a) + g * a) / 255;
+        ++px;
+        *px = (*px * (255-a) + b * a) / 255;
+        ++px;
+        ++px;
+    }
+}
+
+static void scalar_reverse(unsigned char* dst, const unsigned char* src, int n) {
+    const unsigned char* sx = src + n * 4;
+
+    while (n-- > 0) {
+        sx -= 4;
+        memcpy(dst, sx, 4);
+        dst += 4;
+    }
+}
+
+static void scalar_swap_reverse(unsigned char* a, unsigned char* b, int n) {
+    unsigned char* bx = b + n * 4;
+    unsigned char t[4];
+
+    while (n-- > 0) {
+        bx -= 4;
+        memcpy(t, a, 4);
+        memcpy(a, bx, 4);
+        memcpy(bx, t, 4);
+        a += 4;
+    }
+}
+
+static void scalar_over(unsigned char* dst, const unsigned char* src, int n) {
+    int i;
+
+    while (n-- > 0) {
+        int ia = 255 - src[3];
+        for (i = 0; i < 4; i++) {
+            int v = src[i] + dst[i] * ia / 255;
+            dst[i] = v > 255 ? 255 : v;
+        }
+        src += 4;
+        dst += 4;
+    }
+}
+
+// Transpose the part of the block in rows [r0, r1) and columns [c0, c1).
+static void transpose_part(unsigned char* dst, int col_step, int px_step,
+                           const unsigned char* src, int src_row_bytes,
+                           int c0, int c1, int r0, int r1) {
+    int r, c;
+
+    for (r = r0; r < r1; r++) {
+        const unsigned char* sx = src + r * src_row_bytes + c0 * 4;
+        unsigned char* dx = dst + c0 * col_step + r * px_step;
+        for (c = c0; c < c1; c++, sx += 4, dx += col_step)
+            memcpy(dx, sx, 4);
+    }
+}
+
+static void scalar_transpose(unsigned char* dst, int col_step, int px_step,
+                             const unsigned char* src, int src_row_bytes, int w, int h) {
+    int r, c;
+
+    for (r = 0; r < h; r += TRANSPOSE_TILE) {
+        int r1 = r + TRANSPOSE_TILE < h ? r + TRANSPOSE_TILE : h;
+        for (c = 0; c < w; c += TRANSPOSE_TILE) {
+            int c1 = c + TRANSPOSE_TILE < w ? c + TRANSPOSE_TILE : w;
+            transpose_part(dst, col_step, px_step, src, src_row_bytes, c, c1, r, r1);
+        }
+    }
+}
+
+#if RASTER_X86 || RASTER_NEON
+// Tiles of whole 4 x 4 blocks go to 'block', which moves the block at
+// column c, row r; the ragged right and bottom edges are done here.
+static void transpose_tiled(unsigned char* dst, int col_step, int px_step,
+                            const unsigned char* src, int src_row_bytes, int w, int h,
+                            void (*block)(unsigned char*, int, int,
+                                          const unsigned char*, int, int, int)) {
+    int w4 = w & ~3, h4 = h & ~3;
+    int r, c, tr, tc;
+
+    for (tr = 0; tr < h4; tr += TRANSPOSE_TILE) {
+        int r1 = tr + TRANSPOSE_TILE < h4 ? tr + TRANSPOSE_TILE : h4;
+        for (tc = 0; tc < w4; tc += TRANSPOSE_TILE) {
+            int c1 = tc + TRANSPOSE_TILE < w4 ? tc + TRANSPOSE_TILE : w4;
+            for (r = tr; r < r1; r += 4)
+                for (c = tc; c < c1; c += 4)
+                    block(dst, col_step, px_step, src, src_row_bytes, c, r);
+        }
+    }
+    transpose_part(dst, col_step, px_step, src, src_row_bytes, w4, w, 0, h4);
+    transpose_part(dst, col_step, px_step, src, src_row_bytes, 0, w, h4, h);
+}
+#endif
+
+const raster_ops raster_scalar = {
+    .name = "scalar",
+    .fill = scalar_fill,
+    .blend = scalar_blend,
+    .reverse = scalar_reverse,
+    .swap_reverse = scalar_swap_reverse,
+    .transpose = scalar_transpose,
+    .over = scalar_over,
+};
+
+const raster_ops* raster = &raster_scalar;
+
+#if RASTER_X86
+static void sse2_fill(unsigned char* px, int n,
+                      unsigned char r, unsigned char g, unsigned char b) {
+    __m128i v = _mm_set1_epi32((int)pattern(r, g, b));
+
+    for (; n >= 4; n -= 4, px += 16)
+        _mm_storeu_si128((__m128i*)px, v);
+    scalar_fill(px, n, r, g, b);
+}
+
+static __m128i sse2_blend4(__m128i d, __m128i ia, __m128i ca) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia), ca);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia), ca);
+
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+    return _mm_packus_epi16(lo, hi);
+}
+
+static void sse2_blend(unsigned char* px, int n,
+                       unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+    short ia = 255 - a;
+    __m128i iav = _mm_setr_epi16(ia, ia, ia, 255, ia, ia, ia, 255);
+    __m128i cav = _mm_setr_epi16(r * a, g * a, b * a, 0, r * a, g * a, b * a, 0);
+
+    for (; n >= 4; n -= 4, px += 16)
+        _mm_storeu_si128((__m128i*)px, sse2_blend4(_mm_loadu_si128((__m128i*)px), iav, cav));
+    scalar_blend(px, n, r, g, b, a);
+}
+
+#define SSE2_REVERSE(v) _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3))
+
+static void sse2_reverse(unsigned char* dst, const unsigned char* src, int n) {
+    for (; n >= 4; n -= 4, dst += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + (n - 4) * 4));
+        _mm_storeu_si128((__m128i*)dst, SSE2_REVERSE(v));
+    }
+    scalar_reverse(dst, src, n);
+}
+
+static void sse2_swap_reverse(unsigned char* a, unsigned char* b, int n) {
+    for (; n >= 4; n -= 4, a += 16) {
+        __m128i va = _mm_loadu_si128((__m128i*)a);
+        __m128i vb = _mm_loadu_si128((__m128i*)(b + (n - 4) * 4));
+        _mm_storeu_si128((__m128i*)a, SSE2_REVERSE(vb));
+        _mm_storeu_si128((__m128i*)(b + (n - 4) * 4), SSE2_REVERSE(va));
+    }
+    scalar_swap_reverse(a, b, n);
+}
+
+static void sse2_transpose4(unsigned char* dst, int col_step, int px_step,
+                            const unsigned char* src, int src_row_bytes, int c, int r) {
+    const unsigned char* s = src + r * src_row_bytes + c * 4;
+    __m128i a0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(s + src_row_bytes));
+    __m128i a2 = _mm_loadu_si128((const __m128i*)(s + 2 * src_row_bytes));
+    __m128i a3 = _mm_loadu_si128((const __m128i*)(s + 3 * src_row_bytes));
+    __m128i t0 = _mm_unpacklo_epi32(a0, a1), t1 = _mm_unpacklo_epi32(a2, a3);
+    __m128i t2 = _mm_unpackhi_epi32(a0, a1), t3 = _mm_unpackhi_epi32(a2, a3);
+    __m128i col[4];
+    unsigned char* d = dst + c * col_step + r * px_step;
+    int k;
+
+    col[0] = _mm_unpacklo_epi64(t0, t1);
+    col[1] = _mm_unpackhi_epi64(t0, t1);
+    col[2] = _mm_unpacklo_epi64(t2, t3);
+    col[3] = _mm_unpackhi_epi64(t2, t3);
+    for (k = 0; k < 4; k++, d += col_step) {
+        if (px_step > 0)
+            _mm_storeu_si128((__m128i*)d, col[k]);
+        else
+            _mm_storeu_si128((__m128i*)(d - 12), SSE2_REVERSE(col[k]));
+    }
+}
+
+static void sse2_transpose(unsigned char* dst, int col_step, int px_step,
+                           const unsigned char* src, int src_row_bytes, int w, int h) {
+    transpose_tiled(dst, col_step, px_step, src, src_row_bytes, w, h, sse2_transpose4);
+}
+
+// 255 - alpha of each of the four pixels of 's', in all four 16-bit
+// lanes of that pixel: pixels 0 and 1 in *lo, 2 and 3 in *hi.
+static void sse2_inv_alpha(__m128i s, __m128i* lo, __m128i* hi) {
+    __m128i ia = _mm_sub_epi32(_mm_set1_epi32(255), _mm_srli_epi32(s, 24));
+
+    ia = _mm_or_si128(ia, _mm_slli_epi32(ia, 16));
+    *lo = _mm_unpacklo_epi32(ia, ia);
+    *hi = _mm_unpackhi_epi32(ia, ia);
+}
+
+static void sse2_over(unsigned char* dst, const unsigned char* src, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+
+    for (; n >= 4; n -= 4, src += 16, dst += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)src);
+        __m128i d = _mm_loadu_si128((__m128i*)dst);
+        __m128i ia_lo, ia_hi, lo, hi;
+
+        sse2_inv_alpha(s, &ia_lo, &ia_hi);
+        lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia_lo);
+        hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia_hi);
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i*)dst, _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+    }
+    scalar_over(dst, src, n);
+}
+
+static const raster_ops raster_sse2 = {
+    .name = "sse2",
+    .fill = sse2_fill,
+    .blend = sse2_blend,
+    .reverse = sse2_reverse,
+    .swap_reverse = sse2_swap_reverse,
+    .transpose = sse2_transpose,
+    .over = sse2_over,
+};
+
+// The AVX2 kernels finish their rows with the SSE2 ones.  GCC doesn't
+// clear the upper halves of the ymm registers before that tail call,
+// and legacy SSE code run with them dirty is slowed down badly on some
+// cores, so each kernel does it by hand.
+__attribute__((target("avx2")))
+static void avx2_fill(unsigned char* px, int n,
+                      unsigned char r, unsigned char g, unsigned char b) {
+    __m256i v = _mm256_set1_epi32((int)pattern(r, g, b));
+
+    for (; n >= 8; n -= 8, px += 32)
+        _mm256_storeu_si256((__m256i*)px, v);
+    _mm256_zeroupper();
+    sse2_fill(px, n, r, g, b);
+}
+
+__attribute__((target("avx2")))
+static void avx2_blend(unsigned char* px, int n,
+                       unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    short ia = 255 - a;
+    __m256i iav = _mm256_setr_epi16(ia, ia, ia, 255, ia, ia, ia, 255,
+                                    ia, ia, ia, 255, ia, ia, ia, 255);
+    __m256i cav = _mm256_setr_epi16(r * a, g * a, b * a, 0, r * a, g * a, b * a, 0,
+                                    r * a, g * a, b * a, 0, r * a, g * a, b * a, 0);
+
+    for (; n >= 8; n -= 8, px += 32) {
+        __m256i d = _mm256_loadu_si256((__m256i*)px);
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), iav), cav);
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), iav), cav);
+
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, one),
+                                                _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, one),
+                                                _mm256_srli_epi16(hi, 8)), 8);
+        _mm256_storeu_si256((__m256i*)px, _mm256_packus_epi16(lo, hi));
+    }
+    _mm256_zeroupper();
+    sse2_blend(px, n, r, g, b, a);
+}
+
+__attribute__((target("avx2")))
+static void avx2_reverse(unsigned char* dst, const unsigned char* src, int n) {
+    const __m256i rev = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (; n >= 8; n -= 8, dst += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + (n - 8) * 4));
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permutevar8x32_epi32(v, rev));
+    }
+    _mm256_zeroupper();
+    sse2_reverse(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static void avx2_swap_reverse(unsigned char* a, unsigned char* b, int n) {
+    const __m256i rev = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (; n >= 8; n -= 8, a += 32) {
+        __m256i va = _mm256_loadu_si256((__m256i*)a);
+        __m256i vb = _mm256_loadu_si256((__m256i*)(b + (n - 8) * 4));
+        _mm256_storeu_si256((__m256i*)a, _mm256_permutevar8x32_epi32(vb, rev));
+        _mm256_storeu_si256((__m256i*)(b + (n - 8) * 4), _mm256_permutevar8x32_epi32(va, rev));
+    }
+    _mm256_zeroupper();
+    sse2_swap_reverse(a, b, n);
+}
+
+__attribute__((target("avx2")))
+static void avx2_over(unsigned char* dst, const unsigned char* src, int n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+
+    for (; n >= 8; n -= 8, src += 32, dst += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)src);
+        __m256i d = _mm256_loadu_si256((__m256i*)dst);
+        __m256i ia = _mm256_sub_epi32(_mm256_set1_epi32(255), _mm256_srli_epi32(s, 24));
+        __m256i lo, hi;
+
+        // Unpacking works within each 128-bit half, for the pixels and
+        // their alphas alike.
+        ia = _mm256_or_si256(ia, _mm256_slli_epi32(ia, 16));
+        lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi32(ia, ia));
+        hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi32(ia, ia));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, one),
+                                                _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, one),
+                                                _mm256_srli_epi16(hi, 8)), 8);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), s));
+    }
+    _mm256_zeroupper();
+    sse2_over(dst, src, n);
+}
+
+static const raster_ops raster_avx2 = {
+    .name = "avx2",
+    .fill = avx2_fill,
+    .blend = avx2_blend,
+    .reverse = avx2_reverse,
+    .swap_reverse = avx2_swap_reverse,
+    .transpose = sse2_transpose,
+    .over = avx2_over,
+};
+#endif  // RASTER_X86
+
+#if RASTER_NEON
+static void neon_fill(unsigned char* px, int n,
+                      unsigned char r, unsigned char g, unsigned char b) {
+    uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern(r, g, b)));
+
+    for (; n >= 4; n -= 4, px += 16)
+        vst1q_u8(px, v);
+    scalar_fill(px, n, r, g, b);
+}
+
+static uint8x8_t neon_div255(uint16x8_t x) {
+    return vshrn_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8);
+}
+
+static void neon_blend(unsigned char* px, int n,
+                       unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+    const uint8_t ia[8] = { 255 - a, 255 - a, 255 - a, 255, 255 - a, 255 - a, 255 - a, 255 };
+    const uint16_t ca[8] = { r * a, g * a, b * a, 0, r * a, g * a, b * a, 0 };
+    uint8x8_t iav = vld1_u8(ia);
+    uint16x8_t cav = vld1q_u16(ca);
+
+    for (; n >= 4; n -= 4, px += 16) {
+        uint8x16_t d = vld1q_u8(px);
+        uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(d), iav), cav);
+        uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(d), iav), cav);
+        vst1q_u8(px, vcombine_u8(neon_div255(lo), neon_div255(hi)));
+    }
+    scalar_blend(px, n, r, g, b, a);
+}
+
+static uint8x16_t neon_rev4(uint8x16_t v) {
+    uint32x4_t w = vrev64q_u32(vreinterpretq_u32_u8(v));
+    return vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(w), vget_low_u32(w)));
+}
+
+static void neon_reverse(unsigned char* dst, const unsigned char* src, int n) {
+    for (; n >= 4; n -= 4, dst += 16)
+        vst1q_u8(dst, neon_rev4(vld1q_u8(src + (n - 4) * 4)));
+    scalar_reverse(dst, src, n);
+}
+
+static void neon_swap_reverse(unsigned char* a, unsigned char* b, int n) {
+    for (; n >= 4; n -= 4, a += 16) {
+        uint8x16_t va = vld1q_u8(a);
+        uint8x16_t vb = vld1q_u8(b + (n - 4) * 4);
+        vst1q_u8(a, neon_rev4(vb));
+        vst1q_u8(b + (n - 4) * 4, neon_rev4(va));
+    }
+    scalar_swap_reverse(a, b, n);
+}
+
+static void neon_transpose4(unsigned char* dst, int col_step, int px_step,
+                            const unsigned char* src, int src_row_bytes, int c, int r) {
+    const unsigned char* s = src + r * src_row_bytes + c * 4;
+    uint32x4x2_t t01 = vtrnq_u32(vreinterpretq_u32_u8(vld1q_u8(s)),
+                                 vreinterpretq_u32_u8(vld1q_u8(s + src_row_bytes)));
+    uint32x4x2_t t23 = vtrnq_u32(vreinterpretq_u32_u8(vld1q_u8(s + 2 * src_row_bytes)),
+                                 vreinterpretq_u32_u8(vld1q_u8(s + 3 * src_row_bytes)));
+    uint8x16_t col[4];
+    unsigned char* d = dst + c * col_step + r * px_step;
+    int k;
+
+    col[0] = vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+    col[1] = vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+    col[2] = vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+    col[3] = vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+    for (k = 0; k < 4; k++, d += col_step) {
+        if (px_step > 0)
+            vst1q_u8(d, col[k]);
+        else
+            vst1q_u8(d - 12, neon_rev4(col[k]));
+    }
+}
+
+static void neon_transpose(unsigned char* dst, int col_step, int px_step,
+                           const unsigned char* src, int src_row_bytes, int w, int h) {
+    transpose_tiled(dst, col_step, px_step, src, src_row_bytes, w, h, neon_transpose4);
+}
+
+static void neon_over(unsigned char* dst, const unsigned char* src, int n) {
+    for (; n >= 4; n -= 4, src += 16, dst += 16) {
+        uint8x16_t s = vld1q_u8(src);
+        uint8x16_t d = vld1q_u8(dst);
+        // Spread each pixel's alpha over its four bytes, then invert.
+        uint8x16_t ia = vmvnq_u8(vreinterpretq_u8_u32(
+            vmulq_n_u32(vshrq_n_u32(vreinterpretq_u32_u8(s), 24), 0x01010101)));
+        uint16x8_t lo = vmull_u8(vget_low_u8(d), vget_low_u8(ia));
+        uint16x8_t hi = vmull_u8(vget_high_u8(d), vget_high_u8(ia));
+        vst1q_u8(dst, vqaddq_u8(vcombine_u8(neon_div255(lo), neon_div255(hi)), s));
+    }
+    scalar_over(dst, src, n);
+}
+
+static const raster_ops raster_neon = {
+    .name = "neon",
+    .fill = neon_fill,
+    .blend = neon_blend,
+    .reverse = neon_reverse,
+    .swap_reverse = neon_swap_reverse,
+    .transpose = neon_transpose,
+    .over = neon_over,
+};
+#endif  // RASTER_NEON
+
+void raster_init(void) {
+#if RASTER_X86
+    raster = &raster_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        raster = &raster_avx2;
+#elif RASTER_NEON
+    raster = &raster_neon;
+#else
+    raster = &raster_scalar;
+#endif
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINUI_RASTER_H_
+#define MINUI_RASTER_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Row kernels for 4-byte R, G, B, X pixels.  raster_init() picks the
+// fastest set the CPU supports; every set gives the same bytes as
+// raster_scalar, which is kept as the reference.
+typedef struct {
+    const char* name;
+    // Set 'n' pixels to r, g, b.  The pad byte is written as 0xff, as
+    // images are loaded with it.
+    void (*fill)(unsigned char* px, int n,
+                 unsigned char r, unsigned char g, unsigned char b);
+    // Blend r, g, b with alpha 'a' over 'n' pixels, rounding each
+    // channel down as (dst * (255 - a) + src * a) / 255.  The pad
+    // byte is left alone.
+    void (*blend)(unsigned char* px, int n,
+                  unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+    // Copy 'n' pixels from 'src' to 'dst' in reverse order.  The rows
+    // must not overlap.
+    void (*reverse)(unsigned char* dst, const unsigned char* src, int n);
+    // Exchange pixel k of 'a' with pixel n-1-k of 'b', for k < n; a row
+    // turned around in place is its first half against its second.
+    // The two runs must not overlap.
+    void (*swap_reverse)(unsigned char* a, unsigned char* b, int n);
+    // Copy a w x h block of pixels from 'src' turned on its side:
+    // pixel (c, r) lands at dst + c * col_step + r * px_step, where
+    // px_step is 4 or -4 and col_step is plus or minus a row.
+    void (*transpose)(unsigned char* dst, int col_step, int px_step,
+                      const unsigned char* src, int src_row_bytes, int w, int h);
+    // Composite 'n' premultiplied R, G, B, A pixels of 'src' over 'dst':
+    // every byte, the pad included, becomes
+    // src + dst * (255 - alpha) / 255 rounded down, so an opaque
+    // destination stays opaque.
+    void (*over)(unsigned char* dst, const unsigned char* src, int n);
+} raster_ops;
+
+extern const raster_ops raster_scalar;
+extern const raster_ops* raster;
+
+void raster_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MINUI_RASTER_H_
@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks for the minui rasterizer, run on the host or a device:
+//
+//   minui_raster_bench [-c] [-r] [-x] [-t tag] [-s WxH] [-p name] [-n samples]
+//
+// Every primitive is timed on a full screen at each resolution the
+// charger has images for, in its opaque and its blending variant.  A
+// result is the median of the samples that survive Tukey's fences,
+// after a warm-up that also picks how many calls make up one sample.
+// -c prints CSV instead of a table; -t adds a tag column (build, CPU)
+// so runs can be concatenated and compared.  -s and -p run only the
+// matching sizes and primitives.  -r times the scalar reference kernels
+// instead of the ones raster_init() picks; -x checks that those give
+// the same bytes as the reference, and exits.
+//
+// graphics.c and resources.c are compiled into this file so their
+// static helpers can be timed directly, without a backend.
+
+#include "graphics.c"
+#include "resources.c"
+
+#define BENCH_SAMPLES 31
+#define BENCH_WARMUP_NS 50000000LL
+#define BENCH_SAMPLE_NS 2000000LL
+
+int adf_blank_done = 1;
+int flip_enter = 0;
+
+void log_write(int level __unused, const char *fmt __unused, ...) {
+}
+
+minui_backend* open_adf() { return NULL; }
+minui_backend* open_drm() { return NULL; }
+minui_backend* open_fbdev() { return NULL; }
+
+static const struct {
+    int width;
+    int height;
+} bench_sizes[] = {
+    { 360, 640 },
+    { 480, 800 },
+    { 720, 1280 },
+    { 1080, 1920 },
+    { 1440, 2560 },
+};
+
+struct bench {
+    const char* name;
+    const char* variant;
+    // Bytes read and written per pixel, for GB/s.
+    int bytes_per_pixel;
+    void (*setup)(void);
+    void (*run)(void);
+};
+
+static GRSurface bench_screen;
+// Sources are square, to cover the screen either way up.
+static GRSurface bench_rgbx;        // display surface
+static GRSurface bench_mask;        // alpha surface
+static GRSurface bench_rgba;        // premultiplied display surface
+static unsigned char* bench_row;    // a PNG row, up to 4 channels
+static int bench_channels;
+static char bench_line[2048];
+
+static int samples = BENCH_SAMPLES;
+static bool csv = false;
+static const char* tag = NULL;
+
+static long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool surface_alloc(GRSurface* s, int width, int height, int pixel_bytes) {
+    free(s->data);
+    s->width = width;
+    s->height = height;
+    s->pixel_bytes = pixel_bytes;
+    s->row_bytes = width * pixel_bytes;
+    s->data = malloc(height * s->row_bytes);
+    return s->data != NULL;
+}
+
+static void fill_pattern(GRSurface* s) {
+    int i;
+    for (i = 0; i < s->height * s->row_bytes; i++)
+        s->data[i] = (unsigned char)(i * 7 + (i >> 11));
+}
+
+static void opaque(void) { gr_color(0x20, 0xc0, 0x40, 255); }
+static void alpha(void) { gr_color(0x20, 0xc0, 0x40, 128); }
+static void gray(void) { gr_color(0x40, 0x40, 0x40, 255); }
+
+// The same primitives drawing into a rotated panel's coordinates.
+static void opaque_rot(void) { opaque(); rotation = FB_ROTATE_UD; }
+static void alpha_rot(void) { alpha(); rotation = FB_ROTATE_UD; }
+static void opaque_cw(void) { opaque(); rotation = FB_ROTATE_CW; }
+static void alpha_cw(void) { alpha(); rotation = FB_ROTATE_CW; }
+static void opaque_ccw(void) { opaque(); rotation = FB_ROTATE_CCW; }
+
+static void mask_opaque(void) {
+    opaque();
+    memset(bench_mask.data, 255, bench_mask.height * bench_mask.row_bytes);
+}
+
+static void mask_alpha(void) {
+    opaque();
+    fill_pattern(&bench_mask);
+}
+
+// An icon on a transparent ground: clear margins an eighth of the
+// width wide, 16 pixel soft edges and an opaque middle.
+static void rgba_icon(void) {
+    int x, y, w = bench_rgba.width;
+
+    for (y = 0; y < bench_rgba.height; y++) {
+        unsigned char* px = bench_rgba.data + y * bench_rgba.row_bytes;
+        for (x = 0; x < w; x++, px += 4) {
+            int d = (x < w - 1 - x ? x : w - 1 - x) - w / 8;
+            int a = d < 0 ? 0 : d >= 16 ? 255 : d * 16;
+            px[0] = (x & 255) * a / 255;
+            px[1] = (y & 255) * a / 255;
+            px[2] = a / 2;
+            px[3] = a;
+        }
+        measure_span(bench_rgba.data + y * bench_rgba.row_bytes, w, &bench_rgba.spans[y]);
+    }
+}
+
+// Half transparent throughout, so every pixel goes through the kernel.
+static void rgba_glass(void) {
+    int i, y;
+
+    for (i = 0; i < bench_rgba.height * bench_rgba.row_bytes; i++)
+        bench_rgba.data[i] = (i & 3) == 3 ? 128 : (unsigned char)(i * 7) >> 1;
+    for (y = 0; y < bench_rgba.height; y++)
+        measure_span(bench_rgba.data + y * bench_rgba.row_bytes, bench_rgba.width,
+                     &bench_rgba.spans[y]);
+}
+
+static void rgba_icon_rot(void) { rgba_icon(); rotation = FB_ROTATE_UD; }
+
+static void run_fill(void) { gr_fill(0, 0, screen_width(), screen_height()); }
+static void run_clear(void) { gr_clear(); }
+static void run_blit(void) { gr_blit(&bench_rgbx, 0, 0, screen_width(), screen_height(), 0, 0); }
+static void run_blend(void) {
+    gr_blit_blend(&bench_rgba, 0, 0, screen_width(), screen_height(), 0, 0);
+}
+static void run_texticon(void) {
+    GRSurface icon = bench_mask;
+    icon.width = screen_width();
+    icon.height = screen_height();
+    gr_texticon(0, 0, &icon);
+}
+static void run_rotate(void) { gr_rotate_180(); }
+
+static void run_text(void) {
+    int y;
+    for (y = 0; y + gr_font->cheight <= screen_height(); y += gr_font->cheight)
+        gr_text(0, y, bench_line, 0);
+}
+
+static void channels_1(void) { bench_channels = 1; }
+static void channels_3(void) { bench_channels = 3; }
+static void channels_4(void) { bench_channels = 4; }
+
+static void run_transform(void) {
+    int y;
+    for (y = 0; y < gr_draw->height; y++)
+        transform_rgb_to_draw(bench_row, gr_draw->data + y * gr_draw->row_bytes,
+                              bench_channels, gr_draw->width);
+}
+
+static const struct bench benches[] = {
+    { "gr_fill", "opaque", 4, opaque, run_fill },
+    { "gr_fill", "alpha", 8, alpha, run_fill },
+    { "gr_fill", "rot180", 4, opaque_rot, run_fill },
+    { "gr_fill", "rot90", 4, opaque_cw, run_fill },
+    { "gr_clear", "gray", 4, gray, run_clear },
+    { "gr_clear", "color", 4, opaque, run_clear },
+    { "gr_blit", "opaque", 8, opaque, run_blit },
+    { "gr_blit", "rot180", 8, opaque_rot, run_blit },
+    { "gr_blit", "rot90", 8, opaque_cw, run_blit },
+    { "gr_blit", "rot270", 8, opaque_ccw, run_blit },
+    { "gr_blit_blend", "icon", 12, rgba_icon, run_blend },
+    { "gr_blit_blend", "glass", 12, rgba_glass, run_blend },
+    { "gr_blit_blend", "rot180", 12, rgba_icon_rot, run_blend },
+    { "gr_texticon", "opaque", 5, mask_opaque, run_texticon },
+    { "gr_texticon", "alpha", 9, mask_alpha, run_texticon },
+    { "gr_text", "opaque", 5, opaque, run_text },
+    { "gr_text", "alpha", 9, alpha, run_text },
+    { "gr_text", "rot180", 9, alpha_rot, run_text },
+    { "gr_text", "rot90", 9, alpha_cw, run_text },
+    { "gr_rotate_180", "opaque", 8, opaque, run_rotate },
+    { "transform_rgb_to_draw", "gray", 5, channels_1, run_transform },
+    { "transform_rgb_to_draw", "rgb", 7, channels_3, run_transform },
+    { "transform_rgb_to_draw", "rgba", 8, channels_4, run_transform },
+};
+
+// Pixels one call of a primitive touches.  gr_text stops at the last
+// whole character of each line and of the screen.
+static long long bench_pixels(const struct bench* b) {
+    if (b->run == run_text) {
+        int cols = screen_width() / gr_font->cwidth;
+        int rows = screen_height() / gr_font->cheight;
+        return (long long)cols * rows * gr_font->cwidth * gr_font->cheight;
+    }
+    return (long long)gr_draw->width * gr_draw->height;
+}
+
+static int cmp_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Compare the dispatched raster kernels with raster_scalar: every
+// alpha, colour and destination byte, with row lengths that leave a
+// tail for the scalar loop.
+static int raster_check(void) {
+    unsigned char want[259 * 4], got[259 * 4];
+    int a, c, n, i, errors = 0;
+
+    for (a = 0; a < 256; a++) {
+        for (c = 0; c < 256; c++) {
+            for (i = 0; i < (int)sizeof(want); i++)
+                want[i] = got[i] = (unsigned char)(i / 4 + (i & 3) * 85);
+            raster_scalar.blend(want, 259, c, 255 - c, c ^ 0x55, a);
+            raster->blend(got, 259, c, 255 - c, c ^ 0x55, a);
+            if (memcmp(want, got, sizeof(want))) {
+                fprintf(stderr, "%s blend differs: alpha %d colour %d\n", raster->name, a, c);
+                errors++;
+            }
+        }
+    }
+    for (n = 0; n < 67; n++) {
+        memset(want, 0x5a, sizeof(want));
+        memset(got, 0x5a, sizeof(got));
+        raster_scalar.fill(want, n, 0x12, 0x34, 0x56);
+        raster->fill(got, n, 0x12, 0x34, 0x56);
+        if (memcmp(want, got, sizeof(want))) {
+            fprintf(stderr, "%s fill differs: %d pixels\n", raster->name, n);
+            errors++;
+        }
+    }
+    for (n = 0; n < 67; n++) {
+        unsigned char src[67 * 4];
+        for (i = 0; i < (int)sizeof(src); i++)
+            src[i] = (unsigned char)(i * 11);
+        memset(want, 0x5a, sizeof(want));
+        memset(got, 0x5a, sizeof(got));
+        raster_scalar.reverse(want, src, n);
+        raster->reverse(got, src, n);
+        if (memcmp(want, got, sizeof(want))) {
+            fprintf(stderr, "%s reverse differs: %d pixels\n", raster->name, n);
+            errors++;
+        }
+        // A row of 2n + 1 pixels turned around in place.
+        for (i = 0; i < (int)sizeof(want); i++)
+            want[i] = got[i] = (unsigned char)(i * 7);
+        raster_scalar.swap_reverse(want, want + (n + 1) * 4, n);
+        raster->swap_reverse(got, got + (n + 1) * 4, n);
+        if (memcmp(want, got, sizeof(want))) {
+            fprintf(stderr, "%s swap_reverse differs: %d pixels\n", raster->name, n);
+            errors++;
+        }
+    }
+    for (a = 0; a < 256; a++) {
+        for (c = 0; c < 256; c++) {
+            unsigned char src[259 * 4];
+            for (i = 0; i < (int)sizeof(want); i++) {
+                want[i] = got[i] = (unsigned char)(i / 4 + (i & 3) * 85);
+                src[i] = (i & 3) == 3 ? a : ((c + i / 4) & 255) * a / 255;
+            }
+            raster_scalar.over(want, src, 259);
+            raster->over(got, src, 259);
+            if (memcmp(want, got, sizeof(want))) {
+                fprintf(stderr, "%s over differs: alpha %d colour %d\n", raster->name, a, c);
+                errors++;
+            }
+        }
+    }
+    for (n = 0; n < 4; n++) {
+        static const int size[4][2] = { { 16, 16 }, { 21, 13 }, { 3, 37 }, { 64, 5 } };
+        int w = size[n][0], h = size[n][1], sign;
+        unsigned char src[64 * 37 * 4];
+        static unsigned char want_t[64 * 64 * 4], got_t[64 * 64 * 4];
+
+        for (i = 0; i < (int)sizeof(src); i++)
+            src[i] = (unsigned char)(i * 5 + (i >> 8));
+        for (sign = -1; sign <= 1; sign += 2) {
+            // Rows of the 64 x 64 target are 256 bytes; start where a
+            // negative step stays inside.
+            int col_step = 256 * sign, px_step = 4 * -sign;
+            int start = (sign < 0 ? 63 * 256 : 0) + (sign < 0 ? 0 : 63 * 4);
+            memset(want_t, 0x5a, sizeof(want_t));
+            memset(got_t, 0x5a, sizeof(got_t));
+            raster_scalar.transpose(want_t + start, col_step, px_step, src, w * 4, w, h);
+            raster->transpose(got_t + start, col_step, px_step, src, w * 4, w, h);
+            if (memcmp(want_t, got_t, sizeof(want_t))) {
+                fprintf(stderr, "%s transpose differs: %dx%d\n", raster->name, w, h);
+                errors++;
+            }
+        }
+    }
+    fprintf(stderr, "%s: %s\n", raster->name, errors ? "MISMATCH" : "matches scalar");
+    return errors ? 1 : 0;
+}
+
+// Median of 'v' after dropping values outside the Tukey fences; the
+// number kept goes to '*kept'.  Sorts 'v'.
+static long long robust_median(long long* v, int n, int* kept) {
+    long long q1, q3, lo, hi;
+    int first = 0, last = n - 1;
+
+    qsort(v, n, sizeof(*v), cmp_ll);
+    q1 = v[n / 4];
+    q3 = v[(3 * n) / 4];
+    lo = q1 - (q3 - q1) * 3 / 2;
+    hi = q3 + (q3 - q1) * 3 / 2;
+    while (first < last && v[first] < lo)
+        first++;
+    while (last > first && v[last] > hi)
+        last--;
+    *kept = last - first + 1;
+    return v[first + (last - first) / 2];
+}
+
+static void bench_one(const struct bench* b, long long* times) {
+    long long start, pixels, median;
+    int reps = 0, i, r, kept;
+    double ns_per_pixel, gb_per_s;
+
+    rotation = FB_ROTATE_UR;
+    b->setup();
+
+    // Warm up the caches and the CPU clock, counting calls to size a
+    // sample at about BENCH_SAMPLE_NS.
+    start = bench_now_ns();
+    do {
+        b->run();
+        reps++;
+    } while (bench_now_ns() - start < BENCH_WARMUP_NS);
+    reps = (int)(reps * BENCH_SAMPLE_NS / (bench_now_ns() - start));
+    if (reps < 1)
+        reps = 1;
+
+    for (i = 0; i < samples; i++) {
+        start = bench_now_ns();
+        for (r = 0; r < reps; r++)
+            b->run();
+        times[i] = (bench_now_ns() - start) / reps;
+    }
+
+    median = robust_median(times, samples, &kept);
+    pixels = bench_pixels(b);
+    ns_per_pixel = (double)median / pixels;
+    gb_per_s = (double)pixels * b->bytes_per_pixel / median;
+
+    if (csv) {
+        printf("%s%s%s,%s,%s,%d,%d,%lld,%lld,%.4f,%.3f,%d,%d\n",
+               tag ? tag : "", tag ? "," : "", raster->name, b->name, b->variant,
+               gr_draw->width, gr_draw->height, pixels, median,
+               ns_per_pixel, gb_per_s, samples, kept);
+    } else {
+        printf("%-22s %-7s %4dx%-5d %10.3f %10.4f %8.3f %4d/%d\n",
+               b->name, b->variant, gr_draw->width, gr_draw->height,
+               median / 1e6, ns_per_pixel, gb_per_s, kept, samples);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-c] [-r] [-x] [-t tag] [-s WxH] [-p name] [-n samples]\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    const char* only_size = NULL;
+    const char* only_name = NULL;
+    long long* times;
+    unsigned s, b;
+    bool reference = false, check = false;
+    int opt;
+
+    raster_init();
+    while ((opt = getopt(argc, argv, "crxt:s:p:n:")) != -1) {
+        switch (opt) {
+            case 'c': csv = true; break;
+            case 'r': reference = true; break;
+            case 'x': check = true; break;
+            case 't': tag = optarg; break;
+            case 's': only_size = optarg; break;
+            case 'p': only_name = optarg; break;
+            case 'n': samples = atoi(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (check)
+        return raster_check();
+    if (reference)
+        raster = &raster_scalar;
+    if (samples < 4)
+        samples = 4;
+    times = malloc(samples * sizeof(*times));
+    bench_row = malloc(bench_sizes[4].width * 4);
+    if (!times || !bench_row)
+        return 1;
+    memset(bench_line, 'M', sizeof(bench_line) - 1);
+
+    // Keep the font fallback notice out of the CSV.
+    fflush(stdout);
+    opt = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    gr_init_font();
+    fflush(stdout);
+    dup2(opt, STDOUT_FILENO);
+    close(opt);
+    overscan_offset_x = overscan_offset_y = 0;
+    gr_draw = &bench_screen;
+
+    if (csv) {
+        printf("%sraster,primitive,variant,width,height,pixels,ns,ns_per_pixel,gb_per_s,samples,kept\n",
+               tag ? "tag," : "");
+    } else {
+        printf("%s raster kernels\n", raster->name);
+        printf("%-22s %-7s %-10s %10s %10s %8s %s\n", "primitive", "variant",
+               "size", "ms", "ns/pixel", "GB/s", "kept");
+    }
+
+    for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+        int width = bench_sizes[s].width, height = bench_sizes[s].height;
+        char size[32];
+
+        snprintf(size, sizeof(size), "%dx%d", width, height);
+        if (only_size && strcmp(only_size, size))
+            continue;
+        if (!surface_alloc(&bench_screen, width, height, 4) ||
+                !surface_alloc(&bench_rgbx, height, height, 4) ||
+                !surface_alloc(&bench_mask, height, height, 1) ||
+                !surface_alloc(&bench_rgba, height, height, 4) ||
+                !(bench_rgba.spans = realloc(bench_rgba.spans, height * sizeof(GRSpan)))) {
+            fprintf(stderr, "out of memory at %s\n", size);
+            return 1;
+        }
+        fill_pattern(&bench_screen);
+        fill_pattern(&bench_rgbx);
+        memset(bench_row, 0x5a, width * 4);
+
+        for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+            if (only_name && !strstr(benches[b].name, only_name))
+                continue;
+            bench_one(&benches[b], times);
+        }
+    }
+    return 0;
+}
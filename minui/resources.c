@@ -42,16 +42,22 @@ static gr_surface malloc_surface(size_t data_size) {
     gr_surface surface = (gr_surface) temp;
     surface->data = temp + sizeof(GRSurface) +
         (SURFACE_DATA_ALIGNMENT - (sizeof(GRSurface) % SURFACE_DATA_ALIGNMENT));
+    surface->spans = NULL;
     return surface;
 }
 
+// Host tools can point this at a copy of the images.
+#ifndef RES_IMAGE_DIR
+#define RES_IMAGE_DIR "/vendor/etc/res/images"
+#endif
+
 static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
                     png_uint_32* width, png_uint_32* height, png_byte* channels) {
     char resPath[256];
     unsigned char header[8];
     int result = 0;
 
-    snprintf(resPath, sizeof(resPath)-1, "/vendor/etc/res/images/%s.png", name);
+    snprintf(resPath, sizeof(resPath)-1, RES_IMAGE_DIR "/%s.png", name);
     resPath[sizeof(resPath)-1] = '\0';
     FILE* fp = fopen(resPath, "rb");
     if (fp == NULL) {
@@ -133,23 +139,30 @@ static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
 
 // "display" surfaces are transformed into the framebuffer's required
 // pixel format (currently only RGBX is supported) at load time, so
-// gr_blit() can be nothing more than a memcpy() for each row.  The
-// next two functions are the only ones that know anything about the
-// framebuffer pixel format; they need to be modified if the
+// gr_blit() can be nothing more than a memcpy() for each row.  Alpha,
+// if any, is premultiplied and kept in the X byte for gr_blit_blend().
+// The next two functions are the only ones that know anything about
+// the framebuffer pixel format; they need to be modified if the
 // framebuffer format changes (but nothing else should).
 
 // Allocate and return a gr_surface sufficient for storing an image of
-// the indicated size in the framebuffer pixel format.
-static gr_surface init_display_surface(png_uint_32 width, png_uint_32 height) {
+// the indicated size in the framebuffer pixel format.  Images with
+// alpha ('channels' 4) also get a span per row for gr_blit_blend().
+static gr_surface init_display_surface(png_uint_32 width, png_uint_32 height,
+                                       int channels) {
     gr_surface surface;
+    size_t data_size = width * height * 4;
+    size_t span_size = channels == 4 ? height * sizeof(GRSpan) : 0;
 
-    surface = malloc_surface(width * height * 4);
+    surface = malloc_surface(data_size + span_size);
     if (surface == NULL) return NULL;
 
     surface->width = width;
     surface->height = height;
     surface->row_bytes = width * 4;
     surface->pixel_bytes = 4;
+    if (span_size)
+        surface->spans = (GRSpan*) (surface->data + data_size);
 
     return surface;
 }
@@ -160,7 +173,7 @@ static gr_surface init_display_surface(png_uint_32 width, png_uint_32 height) {
 //
 //   1 - input is 8-bit grayscale
 //   3 - input is 24-bit RGB
-//   4 - input is 32-bit RGBA/RGBX
+//   4 - input is 32-bit RGBA, stored with premultiplied alpha
 //
 // 'width' is the number of pixels in the row.
 static void transform_rgb_to_draw(unsigned char* input_row,
@@ -193,12 +206,56 @@ static void transform_rgb_to_draw(unsigned char* input_row,
             break;
 
         case 4:
-            // copy RGBA to RGBX
-            memcpy(output_row, input_row, width*4);
+            // premultiply RGBA, so blending is one multiply per channel
+            for (x = 0; x < width; ++x) {
+                unsigned char a = ip[3];
+                *op++ = (*ip++ * a + 127) / 255;
+                *op++ = (*ip++ * a + 127) / 255;
+                *op++ = (*ip++ * a + 127) / 255;
+                *op++ = *ip++;
+            }
             break;
     }
 }
 
+// Find the transparent ends and the longest opaque run of a row of
+// premultiplied pixels, for gr_blit_blend() to skip and copy.
+static void measure_span(const unsigned char* row, int width, GRSpan* span) {
+    int x, run;
+
+    span->start = 0;
+    while (span->start < width && row[span->start * 4 + 3] == 0)
+        span->start++;
+    span->end = width;
+    while (span->end > span->start && row[(span->end - 1) * 4 + 3] == 0)
+        span->end--;
+
+    span->opaque_start = span->opaque_end = span->end;
+    for (x = span->start; x < span->end; x += run ? run : 1) {
+        for (run = 0; x + run < span->end && row[(x + run) * 4 + 3] == 255; run++)
+            ;
+        if (run > span->opaque_end - span->opaque_start) {
+            span->opaque_start = x;
+            span->opaque_end = x + run;
+        }
+    }
+}
+
+// Drop the spans of an image that turned out to be opaque, so
+// gr_blit_blend() copies it like gr_blit() does.
+static void check_opaque(gr_surface surface) {
+    int y;
+
+    if (surface->spans == NULL)
+        return;
+    for (y = 0; y < surface->height; y++) {
+        const GRSpan* span = &surface->spans[y];
+        if (span->opaque_start != 0 || span->opaque_end != surface->width)
+            return;
+    }
+    surface->spans = NULL;
+}
+
 int res_create_display_surface(const char* name, gr_surface* pSurface) {
     gr_surface surface = NULL;
     int result = 0;
@@ -212,7 +269,7 @@ int res_create_display_surface(const char* name, gr_surface* pSurface) {
     result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels);
     if (result < 0) return result;
 
-    surface = init_display_surface(width, height);
+    surface = init_display_surface(width, height, channels);
     if (surface == NULL) {
         result = -8;
         goto exit;
@@ -221,10 +278,14 @@ int res_create_display_surface(const char* name, gr_surface* pSurface) {
     unsigned char* p_row = malloc(width * 4);
     unsigned int y;
     for (y = 0; y < height; ++y) {
+        unsigned char* out_row = surface->data + y * surface->row_bytes;
         png_read_row(png_ptr, p_row, NULL);
-        transform_rgb_to_draw(p_row, surface->data + y * surface->row_bytes, channels, width);
+        transform_rgb_to_draw(p_row, out_row, channels, width);
+        if (surface->spans)
+            measure_span(out_row, width, &surface->spans[y]);
     }
     free(p_row);
+    check_opaque(surface);
 
     *pSurface = surface;
 
@@ -274,7 +335,7 @@ int res_create_multi_display_surface(const char* name, int* frames, gr_surface**
         goto exit;
     }
     for (i = 0; i < *frames; ++i) {
-        surface[i] = init_display_surface(width, height / *frames);
+        surface[i] = init_display_surface(width, height / *frames, channels);
         if (surface[i] == NULL) {
             result = -8;
             goto exit;
@@ -289,8 +350,12 @@ int res_create_multi_display_surface(const char* name, int* frames, gr_surface**
         unsigned char* out_row = surface[frame]->data +
             (y / *frames) * surface[frame]->row_bytes;
         transform_rgb_to_draw(p_row, out_row, channels, width);
+        if (surface[frame]->spans)
+            measure_span(out_row, width, &surface[frame]->spans[y / *frames]);
     }
     free(p_row);
+    for (i = 0; i < *frames; ++i)
+        check_opaque(surface[i]);
 
     *pSurface = (gr_surface*) surface;
 
@@ -45,7 +45,11 @@ static int request_suspend(bool enable) {
         return autosuspend_disable();
 }
 
+// Returns 1 if turning the screen on left a pre-rendered frame queued
+// for flip (see gr_fb_blank()), 0 otherwise.
 int set_screen_state(int on) {
+    int queued = 0;
+
     if(chip_version){
 	LOGE("chip verison is A do not sleep\n");
 	return 0;
@@ -63,12 +67,12 @@ int set_screen_state(int on) {
     LOGI("*** set_screen_state %d\n", on);
     
     if (screen_on_flag != on) {
-	gr_fb_blank(!on);
+	queued = gr_fb_blank(!on);
 	screen_on_flag = on;
     }
     
     if (!on) 
         request_suspend(true);
 
-    return 0;
+    return queued;
 }
@@ -0,0 +1,150 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "battery.h"
+#include "telemetry.h"
+
+#define TELEMETRY_FILE_SIZE \
+    (sizeof(struct telemetry_header) + TELEMETRY_SAMPLES * sizeof(struct telemetry_sample))
+
+static struct telemetry_header* gHeader;
+static struct telemetry_sample* gSamples;
+static uint32_t gNextSeq;
+static uint32_t gNextSlot;
+static struct timespec gSessionStart;
+static struct telemetry_sample gLast;   /* last one recorded, seq 0 if none */
+
+/* Voltage and temperature move on almost every refresh; on their own
+ * they are only sampled this often, so the ring keeps days of history.
+ */
+#define TELEMETRY_INTERVAL_MS   60000
+
+static int valid_sample(const struct telemetry_sample* s) {
+    return s->seq != 0 && s->check == telemetry_check(s);
+}
+
+// Map the ring file, creating or resetting it if its layout does not
+// match, and continue after the newest valid sample of the previous
+// session.  Samples are only appended from battery_publish_locked(),
+// so recording adds no wakeups of its own.
+int telemetry_init(void) {
+    struct telemetry_header* header;
+    struct stat st;
+    uint32_t i, newest = 0;
+    int fd;
+
+    fd = open(TELEMETRY_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        LOGE("open %s failed: %s\n", TELEMETRY_FILE, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (st.st_size != (off_t)TELEMETRY_FILE_SIZE &&
+            ftruncate(fd, TELEMETRY_FILE_SIZE) < 0)) {
+        LOGE("size %s failed: %s\n", TELEMETRY_FILE, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    header = mmap(NULL, TELEMETRY_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        LOGE("mmap %s failed: %s\n", TELEMETRY_FILE, strerror(errno));
+        return -1;
+    }
+
+    if (header->magic != TELEMETRY_MAGIC || header->version != TELEMETRY_VERSION ||
+            header->sample_size != sizeof(struct telemetry_sample) ||
+            header->capacity != TELEMETRY_SAMPLES) {
+        LOGD("telemetry: resetting %s\n", TELEMETRY_FILE);
+        memset(header, 0, TELEMETRY_FILE_SIZE);
+        header->magic = TELEMETRY_MAGIC;
+        header->version = TELEMETRY_VERSION;
+        header->sample_size = sizeof(struct telemetry_sample);
+        header->capacity = TELEMETRY_SAMPLES;
+    }
+
+    gSamples = (struct telemetry_sample*)(header + 1);
+    for (i = 0; i < TELEMETRY_SAMPLES; i++) {
+        if (valid_sample(&gSamples[i]) && gSamples[i].seq >= newest) {
+            newest = gSamples[i].seq;
+            gNextSlot = (i + 1) % TELEMETRY_SAMPLES;
+        }
+    }
+    gNextSeq = newest + 1;
+
+    header->session++;
+    header->session_start = time(NULL);
+    msync(header, sizeof(*header), MS_SYNC);
+    clock_gettime(CLOCK_MONOTONIC, &gSessionStart);
+    gHeader = header;
+
+    LOGD("telemetry: session %u, next sample %u at slot %u\n",
+            header->session, gNextSeq, gNextSlot);
+
+    // Start the session with the state it was entered in.  This runs
+    // before the event loop, so no battery pass can append meanwhile.
+    struct battery_state state;
+    battery_snapshot(&state);
+    telemetry_record(&state);
+    return 0;
+}
+
+// Append a sample of 'state' if its level, status, health, chargers
+// or time to full moved since the last one, or TELEMETRY_INTERVAL_MS
+// passed; called with gBatteryMutex locked.  Nothing is allocated; the
+// slot is invalidated first and its sequence number written last, so
+// a reader never mistakes a half-written slot for data.
+void telemetry_record(const struct battery_state* state) {
+    struct telemetry_sample next, *s;
+    long long ms;
+
+    if (!gHeader)
+        return;
+
+    ms = (state->timestamp.tv_sec - gSessionStart.tv_sec) * 1000LL +
+            (state->timestamp.tv_nsec - gSessionStart.tv_nsec) / 1000000;
+    memset(&next, 0, sizeof(next));
+    next.session = gHeader->session;
+    next.time_ms = ms < 0 ? 0 : (uint32_t)ms;
+    next.level = state->field[mBatteryLevel];
+    next.temperature = state->field[mBatteryTemperature];
+    next.voltage = state->field[mBatteryVoltage];
+    next.status = state->field[mBatteryStatus];
+    next.health = state->field[mBatteryHealth];
+    next.flags = (state->field[mAcOnline] ? TELEMETRY_AC_ONLINE : 0) |
+            (state->field[mUsbOnline] ? TELEMETRY_USB_ONLINE : 0) |
+            (state->field[mBatteryPresent] ? TELEMETRY_PRESENT : 0);
+    next.time_to_full = state->time_to_full;
+
+    if (gLast.seq && next.level == gLast.level && next.status == gLast.status &&
+            next.health == gLast.health && next.flags == gLast.flags &&
+            next.time_to_full == gLast.time_to_full &&
+            next.time_ms - gLast.time_ms < TELEMETRY_INTERVAL_MS)
+        return;
+
+    s = &gSamples[gNextSlot];
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELEASE);
+    next.seq = gNextSeq;
+    next.check = telemetry_check(&next);
+    memcpy((char*)s + sizeof(s->seq), (char*)&next + sizeof(next.seq),
+            sizeof(next) - sizeof(next.seq));
+    __atomic_store_n(&s->seq, gNextSeq, __ATOMIC_RELEASE);
+    gLast = next;
+
+    gNextSeq++;
+    gNextSlot = (gNextSlot + 1) % TELEMETRY_SAMPLES;
+
+    // Queue the dirty page for writeback now rather than waiting for
+    // the flusher, so a power cut loses as little as possible.
+    msync((void*)((uintptr_t)s & ~(uintptr_t)(getpagesize() - 1)),
+            getpagesize(), MS_ASYNC);
+}
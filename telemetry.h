@@ -0,0 +1,68 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+/* On-disk layout of the charging telemetry ring.  The file is a
+ * telemetry_header followed by 'capacity' fixed-size samples and is
+ * mapped MAP_SHARED by the recorder, so it is shared with the offline
+ * decoder (charge_telemetry_dump) and must stay stable: bump
+ * TELEMETRY_VERSION on any change.
+ */
+#define TELEMETRY_FILE      "/mnt/vendor/charge_telemetry"
+#define TELEMETRY_MAGIC     0x54474843      /* "CHGT" */
+#define TELEMETRY_VERSION   2
+#define TELEMETRY_SAMPLES   2048
+
+struct telemetry_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_size;
+    uint32_t capacity;
+    uint32_t session;           /* bumped each time the recorder starts */
+    uint32_t reserved;
+    int64_t session_start;      /* CLOCK_REALTIME seconds at that start */
+};
+
+#define TELEMETRY_AC_ONLINE     (1 << 0)
+#define TELEMETRY_USB_ONLINE    (1 << 1)
+#define TELEMETRY_PRESENT       (1 << 2)
+
+/* A slot is valid once 'check' matches the rest of it; 'seq' is
+ * written last, so a sample torn by a crash or power loss is skipped
+ * by the decoder instead of being misread.
+ */
+struct telemetry_sample {
+    uint32_t seq;               /* 0: empty, otherwise increases across sessions */
+    uint32_t session;
+    uint32_t time_ms;           /* since the session started */
+    int16_t level;
+    int16_t temperature;        /* 0.1 degC */
+    int32_t voltage;            /* mV */
+    uint16_t status;            /* BATTERY_STATUS_* */
+    uint16_t health;            /* BATTERY_HEALTH_* */
+    uint16_t flags;             /* TELEMETRY_* */
+    int16_t time_to_full;       /* minutes, 0 when full, -1 when unknown */
+    uint32_t check;
+};
+
+static inline uint32_t telemetry_check(const struct telemetry_sample *s) {
+    const uint8_t *p = (const uint8_t *)s;
+    uint32_t h = 2166136261u;   /* FNV-1a over everything but 'check' */
+    unsigned int i;
+
+    for (i = 0; i < sizeof(*s) - sizeof(s->check); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+struct battery_state;
+
+extern int telemetry_init(void);
+extern void telemetry_record(const struct battery_state *state);
+
+#endif  // TELEMETRY_H_
@@ -0,0 +1,148 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+/*
+ * Offline decoder for the charging telemetry ring written by the
+ * charge app.  Pull the file and dump it as CSV:
+ *
+ *   adb pull /mnt/vendor/charge_telemetry
+ *   charge_telemetry_dump charge_telemetry > sessions.csv
+ *
+ * Samples are printed oldest first; torn or empty slots are skipped.
+ * Each sample also carries the app's time to full estimate then.  A
+ * per-session summary (duration, capacity gained, time to full) is
+ * written to stderr.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "battery.h"
+#include "telemetry.h"
+
+static const char* status_name(int status) {
+    switch (status) {
+        case BATTERY_STATUS_CHARGING: return "Charging";
+        case BATTERY_STATUS_DISCHARGING: return "Discharging";
+        case BATTERY_STATUS_NOT_CHARGING: return "Not charging";
+        case BATTERY_STATUS_FULL: return "Full";
+        default: return "Unknown";
+    }
+}
+
+static const char* health_name(int health) {
+    switch (health) {
+        case BATTERY_HEALTH_GOOD: return "Good";
+        case BATTERY_HEALTH_OVERHEAT: return "Overheat";
+        case BATTERY_HEALTH_DEAD: return "Dead";
+        case BATTERY_HEALTH_OVER_VOLTAGE: return "Over voltage";
+        case BATTERY_HEALTH_UNSPECIFIED_FAILURE: return "Unspecified failure";
+        case BATTERY_HEALTH_COLD: return "Cold";
+        default: return "Unknown";
+    }
+}
+
+static int by_seq(const void* a, const void* b) {
+    const struct telemetry_sample* x = *(const struct telemetry_sample* const*)a;
+    const struct telemetry_sample* y = *(const struct telemetry_sample* const*)b;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+struct session_summary {
+    uint32_t session;
+    uint32_t first_ms, last_ms, full_ms;
+    int first_level, last_level;
+    int have_full;
+};
+
+static void print_summary(const struct session_summary* sum) {
+    fprintf(stderr, "session %u: %u s, capacity %d%% -> %d%%",
+            sum->session, (sum->last_ms - sum->first_ms) / 1000,
+            sum->first_level, sum->last_level);
+    if (sum->have_full)
+        fprintf(stderr, ", full after %u s", (sum->full_ms - sum->first_ms) / 1000);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    const char* name = argc > 1 ? argv[1] : TELEMETRY_FILE;
+    struct telemetry_header* header;
+    struct telemetry_sample* samples;
+    struct telemetry_sample** order;
+    struct session_summary sum;
+    struct stat st;
+    char* buf;
+    uint32_t i, n = 0;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    buf = malloc(st.st_size);
+    if (!buf || read(fd, buf, st.st_size) != st.st_size) {
+        fprintf(stderr, "%s: short read\n", name);
+        return 1;
+    }
+    close(fd);
+
+    header = (struct telemetry_header*)buf;
+    if ((size_t)st.st_size < sizeof(*header) || header->magic != TELEMETRY_MAGIC ||
+            header->version != TELEMETRY_VERSION ||
+            header->sample_size != sizeof(struct telemetry_sample) ||
+            sizeof(*header) + (size_t)header->capacity * header->sample_size >
+                    (size_t)st.st_size) {
+        fprintf(stderr, "%s: not a version %d telemetry file\n", name, TELEMETRY_VERSION);
+        return 1;
+    }
+
+    samples = (struct telemetry_sample*)(header + 1);
+    order = calloc(header->capacity, sizeof(*order));
+    if (!order)
+        return 1;
+    for (i = 0; i < header->capacity; i++) {
+        if (samples[i].seq && samples[i].check == telemetry_check(&samples[i]))
+            order[n++] = &samples[i];
+    }
+    qsort(order, n, sizeof(*order), by_seq);
+
+    printf("session,seq,time_ms,level,voltage_mv,temperature_c,status,health,"
+            "ac_online,usb_online,present,time_to_full_min\n");
+    memset(&sum, 0, sizeof(sum));
+    for (i = 0; i < n; i++) {
+        const struct telemetry_sample* s = order[i];
+
+        if (i == 0 || s->session != sum.session) {
+            if (i)
+                print_summary(&sum);
+            memset(&sum, 0, sizeof(sum));
+            sum.session = s->session;
+            sum.first_ms = s->time_ms;
+            sum.first_level = s->level;
+        }
+        sum.last_ms = s->time_ms;
+        sum.last_level = s->level;
+        if (!sum.have_full && s->status == BATTERY_STATUS_FULL) {
+            sum.have_full = 1;
+            sum.full_ms = s->time_ms;
+        }
+
+        printf("%u,%u,%u,%d,%d,%.1f,%s,%s,%d,%d,%d,%d\n",
+                s->session, s->seq, s->time_ms, s->level, s->voltage,
+                s->temperature / 10.0,
+                status_name(s->status), health_name(s->health),
+                !!(s->flags & TELEMETRY_AC_ONLINE),
+                !!(s->flags & TELEMETRY_USB_ONLINE),
+                !!(s->flags & TELEMETRY_PRESENT), s->time_to_full);
+    }
+    if (n)
+        print_summary(&sum);
+
+    free(order);
+    free(buf);
+    return 0;
+}
@@ -33,6 +33,7 @@
 #include "minui/minui.h"
 #include "recovery_ui.h"
 #include "battery.h"
+#include "loop.h"
 #include <errno.h>
 
 #define MAX_COLS 64
@@ -149,9 +150,8 @@ static void res_init(void)
 	return;
 }
 
-static int charge_health_check(void)
+static int charge_health_check(int health_status)
 {
-	int health_status = battery_health();
 	int value = 0;
 	switch (health_status){
 		case BATTERY_HEALTH_OVERHEAT:
@@ -241,6 +241,7 @@ void led_on(int color);
 // Should only be called with gUpdateMutex locked.
 static void draw_background_locked(gr_surface icon) {
     gPagesIdentical = 0;
+    gr_damage_all();
     gr_color(0,  0,  0,  255);
     gr_fill(0,  0,  gr_fb_width(),  gr_fb_height());
 
@@ -253,158 +254,377 @@ static void draw_background_locked(gr_surface icon) {
     }
 }
 
-// Draw the progress bar (if any) on the screen.  Does not flip pages.
-// Should only be called with gUpdateMutex locked.
-static void draw_text_xy(int row,  int col,  const char* t) {
-    if (t[0] != '\0') {
-        gr_text(col,  row,  t, 0);
-    }
-}
+// Minutes to full as last shown; charge_thread only changes it when
+// the displayed minute moves.
+static int gTimeToFull = -1;
 
-static void draw_text_picture(int level)
-{
-	int hundred = 0;
-	int ten = 0;
-	int bit = 0;
-	int width = gr_get_width(gNumber[0]);
-	int height = gr_get_height(gNumber[0]);
-	int capacity_w = gr_get_width(gPercent);
-	int catpcity_h = gr_get_height(gPercent);
-	int dx = (gr_fb_width() - width*4 - capacity_w)/2;
-	int dy= gr_fb_height()/2 - gr_get_height(gProgressBarIndeterminate[0])/2 -  height *2;
-
-	LOGE("get fb width = %d hight = %d  dx = %d dy =%d\n", gr_fb_width(), gr_fb_height(),dx,dy);
-	hundred = level/100;
-	ten = (level%100)/10;
-	bit = level%10;
-
-	if(hundred == 1)
-		gr_blit(gNumber[hundred],0,0,width,height,dx,dy);
-	if(level >= 10)
-		gr_blit(gNumber[ten],0,0,width,height,dx + width,dy);
-	gr_blit(gNumber[bit],0,0,width,height,dx + width*2 ,dy);
-	gr_blit(gPercent,0,0,capacity_w,catpcity_h,dx + width*3,dy);
+char bat[10]={0};
 
+/* Elements of the charging screen.  Each one remembers where it was
+ * drawn and a key for what it showed; when either moves, its old and
+ * new bounds are damaged and only the damaged part of the screen is
+ * cleared and redrawn.
+ */
+enum {
+    ELEM_PERCENT,
+    ELEM_BAR,
+    ELEM_CLOCK,
+    ELEM_TIME_TO_FULL,
+    ELEM_COUNT,
+};
+
+static struct {
+    GRRect rect;
+    int key;
+    int valid;
+} gElements[ELEM_COUNT];
+
+// Record element 'id' at 'r' showing 'key'; a NULL rect hides it.
+static void element_update(int id, const GRRect *r, int key) {
+    static const GRRect none = { 0, 0, 0, 0 };
+    if (!r)
+        r = &none;
+    if (gElements[id].valid && gElements[id].key == key &&
+        !memcmp(&gElements[id].rect, r, sizeof(*r)))
+        return;
+    if (gElements[id].valid)
+        gr_damage(gElements[id].rect.x, gElements[id].rect.y,
+                  gElements[id].rect.w, gElements[id].rect.h);
+    gr_damage(r->x, r->y, r->w, r->h);
+    gElements[id].rect = *r;
+    gElements[id].key = key;
+    gElements[id].valid = 1;
 }
 
-#ifdef SHOW_TIME_DATE_SUPPORT
-static void draw_time_line(void)
-{
-	int hour,hour_unit,min,min_unit,sec,sec_unit,hour_type;
-	char timer_buf[50];
-	time_t t_Now;
-	size_t result;
-	struct tm* t_time;
-	char time_zone[PROPERTY_VALUE_MAX] = {0};
-	int i;
-
-	int width = gr_get_width(gNumber[0]);
-	int height = gr_get_height(gNumber[0]);
-	int colon_w = gr_get_width(gColon);
-	int colon_h = gr_get_height(gColon);
-
-	int dx = (gr_fb_width() - width*4 - colon_w)/2;   // set fist number persion
-	int dy= gr_fb_height()/2 + gr_get_height(gProgressBarIndeterminate[0])/2 +  height;
-
-	property_get("persist.sys.timezone",  time_zone,  "");
-	if(time_zone[0] == '\0'){
-		LOGE("time_zone get failed\n");
-		return;
-	}else{
-		LOGD("time_zone =  %s\n",time_zone);
-	}
+/* Display list for the progress screen.  Where things go, and which
+ * digits are there at all, only depends on the resolution, the error
+ * icon, the clock and the number of digits in the percentage and the
+ * time to full, so the list is only recorded again when one of those
+ * changes.  The digit and animation frame shown are picked per frame
+ * through the vars below.
+ */
+enum {
+    VAR_BAR,
+    VAR_PERCENT_100,
+    VAR_PERCENT_10,
+    VAR_PERCENT_1,
+    VAR_CLOCK_H10,
+    VAR_CLOCK_H1,
+    VAR_CLOCK_M10,
+    VAR_CLOCK_M1,
+    VAR_TTF_H10,
+    VAR_TTF_H1,
+    VAR_TTF_M10,
+    VAR_TTF_M1,
+    VAR_COUNT,
+};
 
-	t_Now = time(NULL);
-	t_time = localtime(&t_Now);
+#define PROGRESS_LIST_SIZE 32
 
-	hour = t_time->tm_hour/10;
-	hour_unit = t_time->tm_hour%10;
-	min = t_time->tm_min/10;
-	min_unit = t_time->tm_min%10;
-    LOGE("t_time->tm_hour = %d t_time->tm_min =%d\n", t_time->tm_hour, t_time->tm_min);
+struct layout {
+    int fb_width;
+    int fb_height;
+    int error;
+    int percent_digits;
+    int ttf_digits;     /* 0 while hidden */
+    int clock;
+};
 
-	gr_blit(gNumber[hour], 0, 0, width, height, dx, dy);
-	gr_blit(gNumber[hour_unit], 0, 0, width, height, dx+width, dy);
+static struct layout gLayout;
+static int gLayoutValid = 0;
+static GRDisplayList *gProgressList;
+static GRRect gPercentRect, gBarRect, gClockRect, gTimeToFullRect;
+#ifdef SHOW_TIME_DATE_SUPPORT
+static char gDateText[16];
 
-	gr_blit(gColon, 0, 0, colon_w, colon_h, dx+width*2, dy);
+// The clock is only shown once a time zone has been set.
+static int clock_shown(void) {
+    static int shown = 0;
+    char time_zone[PROPERTY_VALUE_MAX] = {0};
 
-	gr_blit(gNumber[min], 0, 0, width, height, dx+width*2+colon_w, dy);
-	gr_blit(gNumber[min_unit], 0, 0, width, height, dx+width*3+colon_w, dy);
+    if (!shown) {
+        property_get("persist.sys.timezone",  time_zone,  "");
+        shown = time_zone[0] != '\0';
+    }
+    return shown;
+}
+#endif
 
-	memset(timer_buf,0,sizeof(timer_buf));
-	result = strftime(timer_buf , sizeof(timer_buf) , "%Y-%m-%d" , t_time);
+static void layout_percent(const struct layout *l, int bar_dy, int bar_h) {
+    GRRect *r = &gPercentRect;
+#ifdef PICTURE_SHOW_PERCENT_SUPPORT
+    int width = gr_get_width(gNumber[0]);
+    int height = gr_get_height(gNumber[0]);
+    int capacity_w = gr_get_width(gPercent);
+    int capacity_h = gr_get_height(gPercent);
+
+    r->x = (l->fb_width - width*4 - capacity_w)/2;
+    r->y = l->fb_height/2 - gr_get_height(gProgressBarIndeterminate[0])/2 - height *2;
+    r->w = width*3 + capacity_w;
+    r->h = height > capacity_h ? height : capacity_h;
+
+    if (l->percent_digits == 3)
+        gr_dl_blit_var(gProgressList, gNumber, 10, VAR_PERCENT_100, 0, 0, width, height, r->x, r->y);
+    if (l->percent_digits >= 2)
+        gr_dl_blit_var(gProgressList, gNumber, 10, VAR_PERCENT_10, 0, 0, width, height, r->x + width, r->y);
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_PERCENT_1, 0, 0, width, height, r->x + width*2, r->y);
+    gr_dl_blit(gProgressList, gPercent, 0, 0, capacity_w, capacity_h, r->x + width*3, r->y);
+#else
+    int cw, ch;
+    gr_font_size(&cw, &ch);
+    r->x = l->fb_width/2 - 20;
+    r->y = bar_dy + bar_h;
+    r->w = gr_measure("100%");
+    r->h = ch;
+
+    gr_dl_color(gProgressList, 64,  96,  255,  255);
+    gr_dl_text(gProgressList, r->x, r->y, bat, 4, 0);
+#endif
+}
 
-	if(result !=0){
-		gr_color(34,197,11,255);
-		draw_text_xy(dy + 90, dx + width, timer_buf);
-	}
+#ifdef SHOW_TIME_DATE_SUPPORT
+static void layout_clock(const struct layout *l) {
+    GRRect *r = &gClockRect;
+    int width = gr_get_width(gNumber[0]);
+    int height = gr_get_height(gNumber[0]);
+    int colon_w = gr_get_width(gColon);
+    int colon_h = gr_get_height(gColon);
+    int cw, ch;
+
+    gr_font_size(&cw, &ch);
+    r->x = (l->fb_width - width*4 - colon_w)/2;
+    r->y = l->fb_height/2 + gr_get_height(gProgressBarIndeterminate[0])/2 + height;
+    r->w = width*4 + colon_w;
+    if (width + gr_measure("0000-00-00") > r->w)
+        r->w = width + gr_measure("0000-00-00");
+    r->h = 90 + ch > height ? 90 + ch : height;
+
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_CLOCK_H10, 0, 0, width, height, r->x, r->y);
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_CLOCK_H1, 0, 0, width, height, r->x+width, r->y);
+    gr_dl_blit(gProgressList, gColon, 0, 0, colon_w, colon_h, r->x+width*2, r->y);
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_CLOCK_M10, 0, 0, width, height, r->x+width*2+colon_w, r->y);
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_CLOCK_M1, 0, 0, width, height, r->x+width*3+colon_w, r->y);
+    gr_dl_color(gProgressList, 34, 197, 11, 255);
+    gr_dl_text(gProgressList, r->x + width, r->y + 90, gDateText, sizeof(gDateText) - 1, 0);
+    gr_dl_color(gProgressList, 64,  96,  255,  255);
 }
 #endif
 
-char bat[10]={0};
-static void draw_progress_locked(int level) {
+// The estimated time to full as H:MM below the progress bar.
+static void layout_time_to_full(const struct layout *l) {
+    GRRect *r = &gTimeToFullRect;
+    int width = gr_get_width(gNumber[0]);
+    int height = gr_get_height(gNumber[0]);
+    int colon_w = gr_get_width(gColon);
+    int colon_h = gr_get_height(gColon);
+    int dx;
+
+    r->x = (l->fb_width - width*l->ttf_digits - colon_w)/2;
+    r->y = l->fb_height/2 + gr_get_height(gProgressBarIndeterminate[0])/2 + height;
+#ifdef SHOW_TIME_DATE_SUPPORT
+    r->y += height * 3;	// below the clock and date
+#endif
+    r->w = width*l->ttf_digits + colon_w;
+    r->h = height;
 
-    if (gProgressBarType == PROGRESSBAR_TYPE_NONE) return;
+    dx = r->x;
+    if (l->ttf_digits == 4) {
+        gr_dl_blit_var(gProgressList, gNumber, 10, VAR_TTF_H10, 0, 0, width, height, dx, r->y);
+        dx += width;
+    }
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_TTF_H1, 0, 0, width, height, dx, r->y);
+    gr_dl_blit(gProgressList, gColon, 0, 0, colon_w, colon_h, dx+width, r->y);
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_TTF_M10, 0, 0, width, height, dx+width+colon_w, r->y);
+    gr_dl_blit_var(gProgressList, gNumber, 10, VAR_TTF_M1, 0, 0, width, height, dx+width*2+colon_w, r->y);
+}
 
-    int iconHeight = gr_get_height(gBackgroundIcon[BACKGROUND_ICON_INSTALLING]);
+// Record the progress screen for layout 'l'.
+static int layout_build(const struct layout *l) {
     int width = gr_get_width(gProgressBarEmpty);
     int height = gr_get_height(gProgressBarEmpty);
 
-    int dx = (gr_fb_width() - width)/2;
-    int dy = (gr_fb_height() - height)/2;
-
-    static int frame = 0;
-    static int led_flag = 0;
-
-    // Erase behind the progress bar (in case this was a progress-only update)
-    gr_color(0,  0,  0,  255);
-    gr_fill(0,  0,  gr_fb_width(),  gr_fb_height());
+    if (!gProgressList)
+        gProgressList = gr_dl_create(PROGRESS_LIST_SIZE);
+    if (!gProgressList)
+        return -1;
 
-    gr_color(64,  96,  255,  255);
+    gBarRect.x = (l->fb_width - width)/2;
+    gBarRect.y = (l->fb_height - height)/2;
+    gBarRect.w = width;
+    gBarRect.h = height;
 
-	if( status_index > 0){
-#ifdef PICTURE_SHOW_PERCENT_SUPPORT
-		draw_text_picture(level);
-#else
-		draw_text_xy((dy + height),  (gr_fb_width()/2 - 20),  bat);
+    gr_dl_reset(gProgressList);
+    gr_dl_color(gProgressList, 64,  96,  255,  255);
+#ifdef SHOW_TIME_DATE_SUPPORT
+    if (l->clock)
+        layout_clock(l);
 #endif
-		led_off();
-		gr_blit(gProgressBarError[status_index-1],  0,  0,  width,  height,  dx,  dy);
-		
+    if (l->ttf_digits)
+        layout_time_to_full(l);
+    layout_percent(l, gBarRect.y, height);
+    if (l->error)
+        gr_dl_blit(gProgressList, gProgressBarError[l->error-1], 0, 0, width, height,
+                   gBarRect.x, gBarRect.y);
+    else
+        gr_dl_blit_var(gProgressList, gProgressBarIndeterminate, PROGRESSBAR_INDETERMINATE_STATES,
+                       VAR_BAR, 0, 0, width, height, gBarRect.x, gBarRect.y);
+
+    LOGD("progress layout %dx%d: error %d, %d percent digits, %d time to full digits, clock %d\n",
+         l->fb_width, l->fb_height, l->error, l->percent_digits, l->ttf_digits, l->clock);
+    return 0;
+}
+
+// Pick the digits and animation frame shown this frame.
+static void layout_vars(int *vars, int level, int frame) {
+    memset(vars, 0, sizeof(int) * VAR_COUNT);
+    vars[VAR_BAR] = frame;
+    vars[VAR_PERCENT_100] = level / 100;
+    vars[VAR_PERCENT_10] = (level % 100) / 10;
+    vars[VAR_PERCENT_1] = level % 10;
 #ifdef SHOW_TIME_DATE_SUPPORT
-		draw_time_line();
+    if (gLayout.clock) {
+        time_t t_Now = time(NULL);
+        struct tm *t_time = localtime(&t_Now);
+
+        vars[VAR_CLOCK_H10] = t_time->tm_hour / 10;
+        vars[VAR_CLOCK_H1] = t_time->tm_hour % 10;
+        vars[VAR_CLOCK_M10] = t_time->tm_min / 10;
+        vars[VAR_CLOCK_M1] = t_time->tm_min % 10;
+        if (!strftime(gDateText, sizeof(gDateText), "%Y-%m-%d", t_time))
+            gDateText[0] = '\0';
+    }
 #endif
-		backlight_on();
-		set_screen_state(1);
-		return;
-	}
+    if (gLayout.ttf_digits) {
+        int hour = gTimeToFull / 60 % 100;
+        int min = gTimeToFull % 60;
+
+        vars[VAR_TTF_H10] = hour / 10;
+        vars[VAR_TTF_H1] = hour % 10;
+        vars[VAR_TTF_M10] = min / 10;
+        vars[VAR_TTF_M1] = min % 10;
+    }
+}
 
+/* What the progress screen shows.  update_progress_locked() compares
+ * it with the last frame it rendered and, when they match, leaves the
+ * display alone: no draw, no sync and no flip.
+ */
+struct scene {
+    int type;
+    int level;
+    int frame;
+    int error;
+    int time_to_full;
+    long clock;
+};
+
+static struct scene gScene;
+static int gSceneValid = 0;
+static int gProgressFrame = 0;
+static int gFlipQueued = 0;
+static unsigned int gFramesRendered, gFramesSkipped, gFramesPrerendered;
+
+static void scene_get(struct scene *sc, int level) {
+    memset(sc, 0, sizeof(*sc));
     if (level > 100)
         level = 100;
     else if (level < 0)
         level = 0;
+    sc->type = gProgressBarType;
+    sc->level = level;
+    sc->error = status_index > 0 ? status_index : 0;
+    if (!sc->error) {
+        sc->frame = gProgressBarType == PROGRESSBAR_TYPE_NORMAL ?
+                level * (PROGRESSBAR_INDETERMINATE_STATES - 1) / 100 : gProgressFrame;
+        sc->time_to_full = gTimeToFull;
+    }
+#ifdef SHOW_TIME_DATE_SUPPORT
+    sc->clock = time(NULL) / 60;
+#endif
+}
 
+// An error screen is re-lit every pass in case it was blanked.
+static void error_screen_on(void) {
+    led_off();
+    backlight_on();
+    if (set_screen_state(1) > 0)
+        gFlipQueued = 1;
+}
+
+// Draw the progress bar (if any) on the screen.  Does not flip pages.
+// Should only be called with gUpdateMutex locked.
+static void draw_progress_locked(int level) {
+
+    if (gProgressBarType == PROGRESSBAR_TYPE_NONE) return;
+
+    int frame = gProgressFrame;
+    int error = status_index > 0;
+    int vars[VAR_COUNT];
+    struct layout l;
+    GRRect rects[GR_DAMAGE_MAX];
+    int i, n;
+
+    if (level > 100)
+        level = 100;
+    else if (level < 0)
+        level = 0;
     sprintf(bat,  "%d%%%c",  level,  '\0');
+
+    if (!error && gProgressBarType == PROGRESSBAR_TYPE_NORMAL)
+        frame = level * (PROGRESSBAR_INDETERMINATE_STATES - 1) / 100;
+
+    memset(&l, 0, sizeof(l));
+    l.fb_width = gr_fb_width();
+    l.fb_height = gr_fb_height();
+    l.error = error ? status_index : 0;
+    l.percent_digits = level == 100 ? 3 : level >= 10 ? 2 : 1;
+    if (!error && gTimeToFull > 0)
+        l.ttf_digits = gTimeToFull / 60 >= 10 ? 4 : 3;
 #ifdef SHOW_TIME_DATE_SUPPORT
-	draw_time_line();
+    l.clock = clock_shown();
 #endif
-#ifdef PICTURE_SHOW_PERCENT_SUPPORT
-	draw_text_picture(level);
-#else
-	draw_text_xy((dy + height),  (gr_fb_width()/2 - 20),  bat);
+    if (!gLayoutValid || memcmp(&l, &gLayout, sizeof(l))) {
+        if (layout_build(&l) < 0)
+            return;
+        gLayout = l;
+        gLayoutValid = 1;
+    }
+    layout_vars(vars, level, frame);
+
+    // Work out what moved since the last frame.
+    element_update(ELEM_PERCENT, &gPercentRect, level);
+    element_update(ELEM_BAR, &gBarRect, error ? -status_index : frame);
+#ifdef SHOW_TIME_DATE_SUPPORT
+    element_update(ELEM_CLOCK, l.clock ? &gClockRect : NULL, time(NULL) / 60);
 #endif
-    if (gProgressBarType == PROGRESSBAR_TYPE_NORMAL) {
-        frame = level * (PROGRESSBAR_INDETERMINATE_STATES - 1) / 100;
-        gr_blit(gProgressBarIndeterminate[frame],  0,  0,  width,  height,  dx,  dy);
+    if (l.ttf_digits)
+        element_update(ELEM_TIME_TO_FULL, &gTimeToFullRect, gTimeToFull);
+    else
+        element_update(ELEM_TIME_TO_FULL, NULL, -1);
+
+    // Erase and redraw only the stale part of this buffer.
+    n = gr_damage_region(rects, GR_DAMAGE_MAX);
+    for (i = 0; i < n; i++) {
+        gr_clip(&rects[i]);
+        gr_color(0,  0,  0,  255);
+        gr_fill(rects[i].x,  rects[i].y,  rects[i].x + rects[i].w,  rects[i].y + rects[i].h);
+        gr_dl_replay(gProgressList, vars);
+    }
+    gr_clip(NULL);
+
+    if (error) {
+        gProgressFrame = frame;
+        error_screen_on();
+        return;
     }
 
     if (gProgressBarType == PROGRESSBAR_TYPE_INDETERMINATE) {
-        gr_blit(gProgressBarIndeterminate[frame],  0,  0,  width,  height,  dx,  dy);
         frame = (frame + 1);
         if (frame >= PROGRESSBAR_INDETERMINATE_STATES) {
             frame = level * (PROGRESSBAR_INDETERMINATE_STATES - 1) / 100;
         }
     }
+    gProgressFrame = frame;
 }
 
 static void draw_text_line(int row,  const char* t) {
@@ -459,9 +679,8 @@ static void update_screen_locked(void) {
     gr_flip();
 }
 
-// Updates only the progress bar,  if possible,  otherwise redraws the screen.
-// Should only be called with gUpdateMutex locked.
-static void update_progress_locked(int level) {
+// Draw the scene for 'level' into the current buffer without flipping.
+static void render_locked(int level, const struct scene *sc) {
     gr_sync();
     if (show_text || !gPagesIdentical) {
         draw_screen_locked();    // Must redraw the whole screen
@@ -469,39 +688,51 @@ static void update_progress_locked(int level) {
     } else {
         draw_progress_locked(level);  // Draw only the progress bar
     }
-    gr_flip();
+    gScene = *sc;
+    gSceneValid = !show_text;
 }
 
-extern int is_exit;
-// Keeps the progress bar updated,  even when the process is otherwise busy.
-static void *progress_thread(void *cookie) {
-    for (; !is_exit; ) {
-        usleep(1000000/ PROGRESSBAR_INDETERMINATE_FPS);
-        pthread_mutex_lock(&gUpdateMutex);
-
-        // update the progress bar animation,  if active
-        // skip this if we have a text overlay (too expensive to update)
-        if (gProgressBarType == PROGRESSBAR_TYPE_INDETERMINATE && !show_text) {
-            update_progress_locked(0);
-        }
+// Updates only the progress bar,  if possible,  otherwise redraws the screen.
+// Should only be called with gUpdateMutex locked.
+static void update_progress_locked(int level) {
+    struct scene sc;
+
+    scene_get(&sc, level);
+    if (!show_text && gPagesIdentical && gSceneValid &&
+            !memcmp(&sc, &gScene, sizeof(sc))) {
+        gFramesSkipped++;
+        if (sc.error)
+            error_screen_on();
+        return;
+    }
 
-        // move the progress bar forward on timed intervals,  if configured
-        int duration = gProgressScopeDuration;
-        if (gProgressBarType == PROGRESSBAR_TYPE_NORMAL && duration > 0) {
-            int elapsed = time(NULL) - gProgressScopeTime;
-            float progress = 1.0 * elapsed / duration;
-            if (progress > 1.0) progress = 1.0;
-            if (progress > gProgress) {
-                gProgress = progress;
-                update_progress_locked(0);
-            }
-        }
+    render_locked(level, &sc);
+    // Don't wait for vblank; the next frame can be drawn meanwhile.
+    gFlipQueued = gr_flip_async();
+    gFramesRendered++;
+}
 
-        pthread_mutex_unlock(&gUpdateMutex);
-    }
-    return NULL;
+// While the panel is off, draw the current state into the back buffer
+// and leave it for gr_fb_blank(false) to flip, so a wake shows it
+// without drawing anything first.  Error screens keep the panel on and
+// are left to update_progress_locked().
+static void prerender_locked(int level) {
+    struct scene sc;
+
+    if (status_index > 0 || gProgressBarType == PROGRESSBAR_TYPE_NONE)
+        return;
+    scene_get(&sc, level);
+    if (!show_text && gPagesIdentical && gSceneValid &&
+            !memcmp(&sc, &gScene, sizeof(sc)))
+        return;
+
+    render_locked(level, &sc);
+    gr_flip_on_unblank();
+    gFramesPrerendered++;
 }
 
+extern int is_exit;
+
 #define LED_GREEN         1
 #define LED_RED           2
 #define LED_BLUE          3
@@ -527,49 +758,215 @@ static void led_control(int level) {
      }
 }
 
+/* Filter between the battery snapshot and the LED/screen.  A new raw
+ * value is passed on at once if it moves more than 'band' away from
+ * the value last passed on, otherwise only after it has held for
+ * 'dwell_ms'.  Status and health are enums with no distance between
+ * them, so they use a negative band: every change has to dwell.
+ * Tuned with vendor.charge.filter.<name>=<band>,<dwell_ms>.
+ */
+struct field_filter {
+    const char *name;
+    int band;
+    int dwell_ms;
+    int value;
+    int candidate;
+    long long since;
+    int valid;
+};
+
+static struct field_filter gLevelFilter = { "level", 1, 5000 };
+static struct field_filter gStatusFilter = { "status", -1, 2000 };
+static struct field_filter gHealthFilter = { "health", -1, 3000 };
+
+static unsigned int gRedrawSuppressed, gLedSuppressed;
+
+static long long filter_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void filter_init(struct field_filter *f) {
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+
+    snprintf(key, sizeof(key), "vendor.charge.filter.%s", f->name);
+    if (property_get(key, value, NULL) > 0)
+        sscanf(value, "%d,%d", &f->band, &f->dwell_ms);
+    LOGD("filter %s: band %d, dwell %d ms\n", f->name, f->band, f->dwell_ms);
+}
+
+// Feed one raw sample; returns 1 if the filtered value changed.
+static int filter_apply(struct field_filter *f, int raw, long long now) {
+    if (!f->valid || (f->band >= 0 && abs(raw - f->value) > f->band)) {
+        f->valid = 1;
+        f->value = f->candidate = raw;
+        f->since = now;
+        return 1;
+    }
+    if (raw == f->value) {
+        f->candidate = raw;
+        return 0;
+    }
+    if (raw != f->candidate) {
+        f->candidate = raw;
+        f->since = now;
+    }
+    if (now - f->since < f->dwell_ms)
+        return 0;
+    f->value = raw;
+    return 1;
+}
+
+static int led_color(int level) {
+    return level < 90 ? LED_RED : LED_GREEN;
+}
+
+// Animation cadence unless vendor.charge.anim_fps says otherwise: one
+// progress frame plus the half second pause the charge thread used to
+// sleep.  The battery is polled on its own schedule in battery.c.
+#define CHARGE_ANIM_PERIOD_MS (1000/PROGRESSBAR_INDETERMINATE_FPS + 500)
+// Slack while the screen is on; frames are paced to vsync.
+#define CHARGE_ANIM_SLACK_MS 4
+#define CHARGE_IDLE_SLACK_MS 60
+
 extern int screen_on_flag;
-void *charge_thread(void *cookie) {
-    int fd,  err;
-    char buf;
-    int bat_stat = 0;
+static int gChargeTimer = -1;
+static int gChargePeriod = CHARGE_ANIM_PERIOD_MS;
+static int gBatStat = 0;
+static int gRawColor = 0;
+static int gDrawn = 0;
+#ifdef SHOW_TIME_DATE_SUPPORT
+static time_t gClockMin = 0;
+#endif
+
+// While the screen is on the next frame is timed off the last flip;
+// otherwise just keep the LED and filters running.
+static void charge_rearm(void) {
+	if (screen_on_flag == 1) {
+	    loop_timer_set_slack(gChargeTimer,  CHARGE_ANIM_SLACK_MS);
+	    loop_timer_arm(gChargeTimer,  gr_anim_next_ms());
+	} else {
+	    loop_timer_set_slack(gChargeTimer,  CHARGE_IDLE_SLACK_MS);
+	    loop_timer_arm(gChargeTimer,  gChargePeriod);
+	}
+}
+
+// Loop callback: follow the battery on the LED and the screen.
+static void charge_tick(void *data) {
     int bat_level = 0;
-    for (; !is_exit; ) {
-        usleep(1000000/ PROGRESSBAR_INDETERMINATE_FPS);
-        // update the progress bar animation,  if active
-        if (bat_stat == BATTERY_STATUS_CHARGING) {
-            gProgressBarType = PROGRESSBAR_TYPE_INDETERMINATE;
-        } else {
-            gProgressBarType = PROGRESSBAR_TYPE_NORMAL;
-        }
+    struct battery_state state;
+
+    // update the progress bar animation,  if active
+    if (gBatStat == BATTERY_STATUS_CHARGING) {
+        gProgressBarType = PROGRESSBAR_TYPE_INDETERMINATE;
+    } else {
+        gProgressBarType = PROGRESSBAR_TYPE_NORMAL;
+    }
 
-        bat_level = battery_capacity();
-        bat_stat = battery_status();
+    long long now = filter_now_ms();
+    int changed = 0;
+
+    battery_snapshot(&state);
+    if (gRawColor && led_color(state.field[mBatteryLevel]) != gRawColor &&
+            led_color(state.field[mBatteryLevel]) != led_color(gLevelFilter.value))
+        gLedSuppressed++;
+    gRawColor = led_color(state.field[mBatteryLevel]);
+
+    changed |= filter_apply(&gLevelFilter, state.field[mBatteryLevel], now);
+    changed |= filter_apply(&gStatusFilter, state.field[mBatteryStatus], now);
+    int health_changed = filter_apply(&gHealthFilter, state.field[mBatteryHealth], now);
+    changed |= health_changed;
+    bat_level = gLevelFilter.value;
+    gBatStat = gStatusFilter.value;
 	pthread_mutex_lock(&gchargeMutex);
 	led_control(bat_level);
-	status_index = charge_health_check();
+	// An error screen is re-lit every pass in case it was blanked.
+	if (health_changed || status_index > 0)
+	    status_index = charge_health_check(gHealthFilter.value);
+	if (state.time_to_full != gTimeToFull) {
+	    LOGD("time to full: %d min\n", state.time_to_full);
+	    gTimeToFull = state.time_to_full;
+	    changed = 1;
+	}
+#ifdef SHOW_TIME_DATE_SUPPORT
+	if (time(NULL) / 60 != gClockMin) {
+	    gClockMin = time(NULL) / 60;
+	    changed = 1;
+	}
+#endif
+	if (changed)
+	    LOGD("battery level %d status 0x%x health 0x%x (suppressed %u redraws, %u led writes;"
+	            " %u frames rendered, %u skipped, %u pre-rendered)\n",
+	            bat_level, gBatStat, gHealthFilter.value, gRedrawSuppressed, gLedSuppressed,
+	            gFramesRendered, gFramesSkipped, gFramesPrerendered);
 	if (screen_on_flag == 1) {
-	   update_progress_locked(bat_level);
+	   // The indeterminate bar animates, so only a static screen can
+	   // be left alone when nothing passed the filter.
+	   if (changed || !gDrawn || gProgressBarType == PROGRESSBAR_TYPE_INDETERMINATE) {
+	       update_progress_locked(bat_level);
+	       gDrawn = 1;
+	   } else {
+	       gRedrawSuppressed++;
+	   }
+	} else {
+	   if (gDrawn) {
+	       unsigned int frames, late, dropped;
+	       gr_anim_stats(&frames, &late, &dropped);
+	       LOGD("animation: %u frames, %u late, %u dropped\n", frames, late, dropped);
+	   }
+	   // Keep a frame with the latest state ready for the next wake.
+	   if (changed || gDrawn)
+	       prerender_locked(bat_level);
+	   gDrawn = 0;
 	}
 	pthread_mutex_unlock(&gchargeMutex);
-        usleep(500000);
-    }
 
-    usleep(200);
-    return NULL;
+	// A queued frame re-arms the tick once it is on screen.
+	if (!gFlipQueued)
+	    charge_rearm();
 }
 
-void *power_thread(void *cookie) {
-    for (; !is_exit; ) {
-        if (battery_ac_online() == 0 && battery_usb_online() == 0) {
-            LOGE("charger not present,  power off device\n");
-            backlight_off();
-            is_exit = 1;
-            reboot(RB_POWER_OFF);
-            usleep(200);
-        }
-	 usleep(500000);
+// Loop callback: a queued flip completed.
+static void flip_on_event(int fd, uint32_t events, void *data) {
+	if (gr_flip_events() || !gFlipQueued)
+	    return;
+	gFlipQueued = 0;
+	charge_rearm();
+}
+
+// Blanking waits out a queued flip, so its event never reaches
+// flip_on_event(); pick the tick up here when that happened.  A frame
+// flipped on unblank re-arms the tick once it is on screen, like any
+// other queued frame.
+static void charge_screen_state(int on) {
+	if (set_screen_state(on) > 0) {
+	    gFlipQueued = 1;
+	    loop_timer_cancel(gChargeTimer);
+	} else if (gFlipQueued && !gr_flip_events()) {
+	    gFlipQueued = 0;
+	    charge_rearm();
+	}
+}
+
+// Loop callback: power off once no charger is left.
+static void power_tick(void *data) {
+    static unsigned int generation = 0;
+    struct battery_state state;
+
+    // Nothing to re-evaluate until the battery snapshot moves.
+    if (generation != 0 && battery_generation() == generation)
+        return;
+    battery_snapshot(&state);
+    generation = state.generation;
+    if (state.field[mAcOnline] == 0 && state.field[mUsbOnline] == 0) {
+        LOGE("charger not present,  power off device\n");
+        backlight_off();
+        is_exit = 1;
+        reboot(RB_POWER_OFF);
+        usleep(200);
     }
-    return NULL;
 }
 
 void set_backlight(int bright) {
@@ -603,104 +1000,123 @@ static int powerkey_status_get(void) {
 
     return powerkey_status;
 }
-// Reads input events,  handles special hot keys,  and adds to the key queue.
+/* Power key and RTC alarm handling.  What used to be nested ev_get()
+ * timeouts in input_thread is now one loop timer whose meaning depends
+ * on gInputState:
+ *   INPUT_SCREEN_ON      blank the screen when it fires
+ *   INPUT_KEY_HELD       power key held for POWER_KEY_TIMEOUT_MS: reboot
+ *   INPUT_KEY_RELEASED   turn the backlight on after the key came up
+ */
+enum input_state {
+	INPUT_SCREEN_ON,
+	INPUT_KEY_HELD,
+	INPUT_KEY_RELEASED,
+};
+
+static enum input_state gInputState = INPUT_SCREEN_ON;
+static int gInputTimer = -1;
+
+static void input_handle_key(struct input_event *ev) {
+	LOGD(" %s: %d,  ev.type:%d,  ev.code:%d,  ev.value:%d  state = %d\n",  __func__,  \
+			__LINE__,  ev->type,  ev->code,  ev->value,  gInputState);
+
+	if (gInputState == INPUT_KEY_HELD) {
+		// Only the power key release matters until the timeout.
+		if ((ev->code == KEY_POWER) && (ev->value == 0)) {
+			LOGD(" %s: %d %s\n",  __func__,  __LINE__,  "power key up found\n");
+			gInputState = INPUT_KEY_RELEASED;
+			loop_timer_arm(gInputTimer,  500);
+		}
+		return;
+	}
+
+	if (ev->code == KEY_POWER) {
+		pthread_mutex_lock(&gchargeMutex);
+		charge_screen_state(1);
+		pthread_mutex_unlock(&gchargeMutex);
+		gInputState = INPUT_KEY_HELD;
+		loop_timer_arm(gInputTimer,  POWER_KEY_TIMEOUT_MS);
+		return;
+	}
+
+	if (ev->code == KEY_BRL_DOT8) { /* alarm event happen */
+		pthread_mutex_lock(&gchargeMutex);
+		charge_screen_state(1);
+		pthread_mutex_unlock(&gchargeMutex);
+		if (alarm_flag_check()) {
+			is_exit = 1;
+			LOGD(" %s: %d,  %s\n",  __func__,  __LINE__, "alarm happen 1,  exit");
+			syscall(__NR_reboot, LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2, LINUX_REBOOT_CMD_RESTART2, "alarm");
+			usleep(500000);
+			LOGD(" %s: %d,  %s\n",  __func__,  __LINE__, "alarm reboot failed");
+		} else {
+			backlight_off();
+			pthread_mutex_lock(&gchargeMutex);
+			charge_screen_state(0);
+			pthread_mutex_unlock(&gchargeMutex);
+		}
+	}
+}
 
-void  *input_thread(void *write_fd) {
-	int ret = 0;
-	struct timeval start_time = {0,  0};
-	struct timeval now_time = {0,  0};
+// Loop callback: an input device or the RTC is readable.
+static void input_on_event(int fd, uint32_t events, void *data) {
 	struct input_event ev;
 
-	int i = 5;
-	char cmd = 0;
-
-	int time_left;
-	long long time_diff_temp;
-
-	time_left = BACKLIGHT_ON_MS;
-	for (; !is_exit; ) {
-
-		ret = ev_get(&ev,  POLLING_MS);
-		LOGD(" %s: %d,  ret:%d,  ev.type:%d,  ev.code:%d,  ev.value:%d  time_left = %d\n",  __func__,  \
-						__LINE__,  ret,  ev.type,  ev.code,  ev.value ,time_left);
-key_check:
-		if(ret == 0){
-			if(ev.code == KEY_POWER){
-				pthread_mutex_lock(&gchargeMutex);
-				set_screen_state(1);
-				pthread_mutex_unlock(&gchargeMutex);
-				time_left =  POWER_KEY_TIMEOUT_MS;
-				do{
-					while (gettimeofday(&start_time,  (struct timezone *)0) < 0) {;}
-					ret = ev_get(&ev,  time_left);
-					while (gettimeofday(&now_time,  (struct timezone *)0) < 0) {;}
-					time_diff_temp = timeval_diff(now_time,  start_time);
-					time_diff_temp = (time_diff_temp + 1000)/1000;
-					time_left = time_left - time_diff_temp;
-
-					LOGD(" %s: %d,  ret:%d,  ev.type:%d,  ev.code:%d,  ev.value:%d  time_left = %d\n",  __func__,  \
-					__LINE__,  ret,  ev.type,  ev.code,  ev.value ,time_left);
-
-					if((ret == 0) && (ev.code == KEY_POWER) && (ev.value == 0) ){
-						LOGD(" %s: %d %s\n",  __func__,  __LINE__,  "power key up found\n");
-						usleep(500000);
-						backlight_on();
-						time_left = BACKLIGHT_ON_MS;
-						break;
-					}
-					if(time_left < 0){
-						LOGD(" %s: %d\n",  __func__,  __LINE__);
-						is_exit = 1;
-						syscall(__NR_reboot, LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2, LINUX_REBOOT_CMD_RESTART2, "charger");
-						usleep(500000);
-						LOGD(" %s: %d,  reboot failed\n",  __func__,  __LINE__);
-						break;
-					}
-				}while(time_left > 0);
-			}
-			if (ev.code == KEY_BRL_DOT8) { /* alarm event happen */
-				pthread_mutex_lock(&gchargeMutex);
-				set_screen_state(1);
-				pthread_mutex_unlock(&gchargeMutex);
-				if (alarm_flag_check()) {
-					is_exit = 1;
-					LOGD(" %s: %d,  %s\n",  __func__,  __LINE__, "alarm happen 1,  exit");
-					syscall(__NR_reboot, LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2, LINUX_REBOOT_CMD_RESTART2, "alarm");
-					usleep(500000);
-					LOGD(" %s: %d,  %s\n",  __func__,  __LINE__, "alarm reboot failed");
-					break;
-				} else {
-					backlight_off();
-					pthread_mutex_lock(&gchargeMutex);
-					set_screen_state(0);
-					pthread_mutex_unlock(&gchargeMutex);
-				}
-            }
-		}else{
-			do{
-				while (gettimeofday(&start_time,  (struct timezone *)0) < 0) {;}
-				ret = ev_get(&ev,  time_left);
-				while (gettimeofday(&now_time,  (struct timezone *)0) < 0) {;}
-				time_diff_temp = timeval_diff(now_time,  start_time);
-				time_diff_temp = (time_diff_temp + 1000)/1000;
-				time_left = time_left - time_diff_temp;
-
-				LOGD(" %s: %d,  ret:%d,  ev.type:%d,  ev.code:%d,  ev.value:%d time_left = %d \n",  __func__,  \
-				__LINE__,  ret,  ev.type,  ev.code,  ev.value ,time_left);
-				if(ret == 0)
-					goto key_check;
-				if(time_left <= 0){
-					backlight_off();
-					pthread_mutex_lock(&gchargeMutex);					
-					set_screen_state(0);
-					pthread_mutex_unlock(&gchargeMutex);
-					time_left = WAKEUP_ON_MS;
-					break;
-				}
-			}while(time_left > 0);
-		}
+	if (ev_read((uintptr_t)data, &ev) == 0)
+		input_handle_key(&ev);
+}
+
+// Loop callback: the input timer fired.
+static void input_on_timer(void *data) {
+	switch (gInputState) {
+	case INPUT_KEY_HELD:
+		LOGD(" %s: %d\n",  __func__,  __LINE__);
+		is_exit = 1;
+		syscall(__NR_reboot, LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2, LINUX_REBOOT_CMD_RESTART2, "charger");
+		usleep(500000);
+		LOGD(" %s: %d,  reboot failed\n",  __func__,  __LINE__);
+		break;
+	case INPUT_KEY_RELEASED:
+		backlight_on();
+		gInputState = INPUT_SCREEN_ON;
+		loop_timer_arm(gInputTimer,  BACKLIGHT_ON_MS);
+		break;
+	default:
+		backlight_off();
+		pthread_mutex_lock(&gchargeMutex);
+		charge_screen_state(0);
+		pthread_mutex_unlock(&gchargeMutex);
+		loop_timer_arm(gInputTimer,  WAKEUP_ON_MS);
+		break;
 	}
-	return NULL;
+}
+
+// Register the charge, power and input callbacks with the event loop.
+// The periodic ones get enough slack to share wakeups.
+void ui_loop_init(void) {
+	char value[PROPERTY_VALUE_MAX];
+	unsigned n;
+	int fd;
+
+	filter_init(&gLevelFilter);
+	filter_init(&gStatusFilter);
+	filter_init(&gHealthFilter);
+
+	if (property_get("vendor.charge.anim_fps",  value,  NULL) > 0 && atof(value) > 0)
+		gChargePeriod = (int)(1000 / atof(value));
+	LOGD("animation period %d ms\n",  gChargePeriod);
+	gr_anim_set_period(gChargePeriod);
+
+	gChargeTimer = loop_add_timer(charge_tick,  NULL,  0,  CHARGE_IDLE_SLACK_MS);
+	loop_timer_arm(gChargeTimer,  gChargePeriod);
+	if ((fd = gr_flip_fd()) >= 0)
+		loop_add_fd(fd,  flip_on_event,  NULL);
+	loop_add_timer(power_tick,  NULL,  500,  250);
+
+	for (n = 0; (fd = ev_get_fd(n)) >= 0; n++)
+		loop_add_fd(fd,  input_on_event,  (void *)(uintptr_t)n);
+	gInputTimer = loop_add_timer(input_on_timer,  NULL,  0,  100);
+	loop_timer_arm(gInputTimer,  BACKLIGHT_ON_MS);
 }
 
 void ui_init(void) {
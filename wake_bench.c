@@ -0,0 +1,411 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+/*
+ * Power key to photon benchmark for a developer Linux machine.
+ *
+ * Links the real ui.c, power.c and event loop against a fake panel,
+ * battery, backlight and suspend, creates a KEY_POWER device through
+ * /dev/uinput and presses it repeatedly.  Each wake is timed from the
+ * key press to:
+ *
+ *   read     the event loop picked the key up
+ *   unblank  the panel was switched back on
+ *   draw     a frame with current content was handed to the panel
+ *   photon   that frame's vsync
+ *
+ * and percentiles are printed per stage.  Needs root for /dev/uinput:
+ *
+ *   sudo charge_wake_bench [-n iterations] [-v]
+ *
+ * -v sends the app's log to stderr instead of dropping it.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include "common.h"
+#include "battery.h"
+#include "loop.h"
+#include "minui/minui.h"
+#include "minui/graphics.h"
+
+void ui_loop_init(void);
+
+#define BENCH_DEVICE "charge-wake-bench"
+#define BENCH_WIDTH 720
+#define BENCH_HEIGHT 1280
+#define BENCH_REFRESH_NS 16666667LL
+// Long enough for the charge tick to pre-render with the panel off.
+#define BENCH_SETTLE_MS 1500
+// Well inside POWER_KEY_TIMEOUT_MS, which would reboot.
+#define BENCH_PRESS_MS 30
+#define BENCH_WAKE_MS 800
+
+enum {
+    STAGE_READ,
+    STAGE_UNBLANK,
+    STAGE_DRAW,
+    STAGE_PHOTON,
+    STAGE_COUNT,
+};
+
+static const char *gStageNames[STAGE_COUNT] = { "read", "unblank", "draw", "photon" };
+
+int is_exit = 0;
+int chip_version = 0;
+
+static int gVerbose = 0;
+static int gUinputFd = -1;
+static int gEventFd = -1;
+static int gTimer = -1;
+static int gIterations = 100;
+static int gTried = 0;
+static int gDone = 0;
+static int gNoRedraw = 0;
+
+// The wake being timed; times are CLOCK_MONOTONIC ns, 0 until seen.
+static int gWaking = 0;
+static long long gPress;
+static long long gStage[STAGE_COUNT];
+static long long *gSamples[STAGE_COUNT];
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Stand-ins for the parts of the app that touch hardware. */
+
+void log_write(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if (!gVerbose)
+        return;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void backlight_on(void) {}
+void backlight_off(void) {}
+void led_on(int color) {}
+void led_off(void) {}
+int autosuspend_enable(void) { return 0; }
+int autosuspend_disable(void) { return 0; }
+
+// A charging battery on AC, so power_tick() never powers off.
+void battery_snapshot(struct battery_state *out) {
+    memset(out, 0, sizeof(*out));
+    out->field[mAcOnline] = 1;
+    out->field[mBatteryStatus] = BATTERY_STATUS_CHARGING;
+    out->field[mBatteryHealth] = BATTERY_HEALTH_GOOD;
+    out->field[mBatteryPresent] = 1;
+    out->field[mBatteryLevel] = 57;
+    out->generation = 1;
+    out->time_to_full = 42;
+    clock_gettime(CLOCK_MONOTONIC, &out->timestamp);
+}
+
+unsigned int battery_generation(void) {
+    return 1;
+}
+
+// ui.c reboots on a long press or an alarm; never let that reach the
+// machine the benchmark runs on.
+int reboot(int cmd) {
+    fprintf(stderr, "reboot(0x%x) blocked\n", cmd);
+    return -1;
+}
+
+long syscall(long number, ...) {
+    fprintf(stderr, "syscall(%ld) blocked\n", number);
+    errno = EPERM;
+    return -1;
+}
+
+/* Fake panel: two buffers in memory, flips land on a 60 Hz vsync grid. */
+
+static GRSurface gBuffers[2];
+static int gFront = 0;
+static long long gVsync = 0;
+
+static gr_surface bench_init(minui_backend *backend) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        gBuffers[i].width = BENCH_WIDTH;
+        gBuffers[i].height = BENCH_HEIGHT;
+        gBuffers[i].pixel_bytes = 4;
+        gBuffers[i].row_bytes = BENCH_WIDTH * 4;
+        gBuffers[i].data = calloc(BENCH_HEIGHT, BENCH_WIDTH * 4);
+        if (!gBuffers[i].data)
+            return NULL;
+    }
+    return &gBuffers[1];
+}
+
+static gr_surface bench_flip(minui_backend *backend) {
+    long long now = now_ns();
+
+    if (gWaking && gStage[STAGE_UNBLANK] && !gStage[STAGE_DRAW])
+        gStage[STAGE_DRAW] = now;
+    gVsync = (now / BENCH_REFRESH_NS + 1) * BENCH_REFRESH_NS;
+    while (now_ns() < gVsync)
+        ;
+    if (gWaking && gStage[STAGE_DRAW] && !gStage[STAGE_PHOTON])
+        gStage[STAGE_PHOTON] = gVsync;
+    gFront = 1 - gFront;
+    return &gBuffers[1 - gFront];
+}
+
+static void bench_blank(minui_backend *backend, bool blank) {
+    if (!blank && gWaking && !gStage[STAGE_UNBLANK])
+        gStage[STAGE_UNBLANK] = now_ns();
+}
+
+static void bench_exit(minui_backend *backend) {
+    free(gBuffers[0].data);
+    free(gBuffers[1].data);
+}
+
+static void bench_timing(minui_backend *backend, long long *vsync_ns, long long *refresh_ns) {
+    *vsync_ns = gVsync;
+    *refresh_ns = BENCH_REFRESH_NS;
+}
+
+static minui_backend gBackend = {
+    .init = bench_init,
+    .flip = bench_flip,
+    .blank = bench_blank,
+    .exit = bench_exit,
+    .timing = bench_timing,
+};
+
+minui_backend *open_adf(void) { return &gBackend; }
+minui_backend *open_drm(void) { return NULL; }
+minui_backend *open_fbdev(void) { return NULL; }
+
+/* The key. */
+
+static int uinput_create(void) {
+    struct uinput_user_dev dev;
+    int fd;
+
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "/dev/uinput: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(&dev, 0, sizeof(dev));
+    snprintf(dev.name, sizeof(dev.name), BENCH_DEVICE);
+    dev.id.bustype = BUS_VIRTUAL;
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+            ioctl(fd, UI_SET_KEYBIT, KEY_POWER) < 0 ||
+            write(fd, &dev, sizeof(dev)) != sizeof(dev) ||
+            ioctl(fd, UI_DEV_CREATE) < 0) {
+        fprintf(stderr, "creating uinput device: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Open our own reader on the new device.  Opened before ev_init(), it
+// is woken ahead of the app's reader, so its callback marks when the
+// loop picked the key up.
+static int open_event_node(void) {
+    char name[64];
+    int tries, fd;
+
+    for (tries = 0; tries < 50; tries++) {
+        DIR *dir = opendir("/dev/input");
+        struct dirent *de;
+
+        while (dir && (de = readdir(dir))) {
+            if (strncmp(de->d_name, "event", 5))
+                continue;
+            fd = openat(dirfd(dir), de->d_name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+            if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) > 0 &&
+                    !strcmp(name, BENCH_DEVICE)) {
+                closedir(dir);
+                return fd;
+            }
+            close(fd);
+        }
+        if (dir)
+            closedir(dir);
+        usleep(20000);      // give udev a moment to create the node
+    }
+    fprintf(stderr, "no /dev/input node for %s\n", BENCH_DEVICE);
+    return -1;
+}
+
+static void emit(int type, int code, int value) {
+    struct input_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    if (write(gUinputFd, &ev, sizeof(ev)) != sizeof(ev))
+        fprintf(stderr, "uinput write: %s\n", strerror(errno));
+}
+
+static void press(int value) {
+    emit(EV_KEY, KEY_POWER, value);
+    emit(EV_SYN, SYN_REPORT, 0);
+}
+
+static void on_event(int fd, uint32_t events, void *data) {
+    struct input_event ev;
+
+    while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+        if (gWaking && !gStage[STAGE_READ] && ev.type == EV_KEY && ev.value == 1)
+            gStage[STAGE_READ] = now_ns();
+    }
+}
+
+/* One wake: panel off, settle, press, release, collect. */
+
+enum {
+    STEP_OFF,
+    STEP_PRESS,
+    STEP_RELEASE,
+};
+
+static int gStep = STEP_OFF;
+
+static void collect(void) {
+    int i;
+
+    if (!gWaking)
+        return;
+    gWaking = 0;
+    gTried++;
+    if (!gStage[STAGE_READ] || !gStage[STAGE_UNBLANK]) {
+        fprintf(stderr, "wake %d: key not seen, dropped\n", gTried);
+        return;
+    }
+    // Nothing was flipped: the panel already showed the current scene.
+    if (!gStage[STAGE_PHOTON]) {
+        gStage[STAGE_DRAW] = gStage[STAGE_PHOTON] = gStage[STAGE_UNBLANK];
+        gNoRedraw++;
+    }
+    for (i = 0; i < STAGE_COUNT; i++)
+        gSamples[i][gDone] = gStage[i] - gPress;
+    gDone++;
+}
+
+static void on_timer(void *data) {
+    switch (gStep) {
+    case STEP_OFF:
+        collect();
+        if (gTried >= gIterations) {
+            is_exit = 1;
+            return;
+        }
+        set_screen_state(0);
+        gStep = STEP_PRESS;
+        loop_timer_arm(gTimer, BENCH_SETTLE_MS);
+        break;
+    case STEP_PRESS:
+        memset(gStage, 0, sizeof(gStage));
+        gWaking = 1;
+        gPress = now_ns();
+        press(1);
+        gStep = STEP_RELEASE;
+        loop_timer_arm(gTimer, BENCH_PRESS_MS);
+        break;
+    case STEP_RELEASE:
+        press(0);
+        gStep = STEP_OFF;
+        loop_timer_arm(gTimer, BENCH_WAKE_MS);
+        break;
+    }
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(long long *v, int n, int pct) {
+    int i = (n - 1) * pct / 100;
+    return v[i] / 1e6;
+}
+
+static void report(void) {
+    int i;
+
+    printf("%d of %d wakes timed, %d needed no redraw\n", gDone, gTried, gNoRedraw);
+    printf("%-8s %8s %8s %8s %8s  (ms after key press)\n", "stage", "p50", "p90", "p99", "max");
+    for (i = 0; i < STAGE_COUNT && gDone > 0; i++) {
+        qsort(gSamples[i], gDone, sizeof(long long), cmp_ll);
+        printf("%-8s %8.2f %8.2f %8.2f %8.2f\n", gStageNames[i],
+               percentile_ms(gSamples[i], gDone, 50),
+               percentile_ms(gSamples[i], gDone, 90),
+               percentile_ms(gSamples[i], gDone, 99),
+               gSamples[i][gDone - 1] / 1e6);
+    }
+}
+
+int main(int argc, char **argv) {
+    int i, opt;
+
+    while ((opt = getopt(argc, argv, "n:v")) != -1) {
+        switch (opt) {
+        case 'n':
+            gIterations = atoi(optarg);
+            break;
+        case 'v':
+            gVerbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (gIterations <= 0)
+        gIterations = 1;
+    for (i = 0; i < STAGE_COUNT; i++) {
+        gSamples[i] = calloc(gIterations, sizeof(long long));
+        if (!gSamples[i])
+            return 1;
+    }
+
+    gUinputFd = uinput_create();
+    if (gUinputFd < 0)
+        return 1;
+    gEventFd = open_event_node();
+    if (gEventFd < 0)
+        return 1;
+
+    ui_init();
+    if (loop_init() < 0)
+        return 1;
+    loop_add_fd(gEventFd, on_event, NULL);
+    ui_loop_init();
+    gTimer = loop_add_timer(on_timer, NULL, 0, 0);
+    loop_timer_arm(gTimer, BENCH_SETTLE_MS);
+
+    fprintf(stderr, "timing %d wakes, about %d s\n", gIterations,
+            gIterations * (BENCH_SETTLE_MS + BENCH_PRESS_MS + BENCH_WAKE_MS) / 1000);
+    loop_run();
+    report();
+
+    ioctl(gUinputFd, UI_DEV_DESTROY);
+    close(gUinputFd);
+    return 0;
+}